@@ -0,0 +1,146 @@
+#ifndef CLOVER_GNC_RPC_PROTOCOL_H
+#define CLOVER_GNC_RPC_PROTOCOL_H
+
+/*
+ * Wire format of the binary RPC protocol served on the same TCP port as the text commands. This header has no Zephyr
+ * dependencies so host tools can include it directly.
+ *
+ * A client selects the protocol by sending RPC_MAGIC as the very first bytes of a connection; the server echoes the
+ * magic back and the rest of the connection is binary. Text commands always start with a letter, so they can never be
+ * mistaken for the magic.
+ *
+ * Every message after that is a frame: an rpc_frame_header followed by `length` payload bytes. Requests set `status`
+ * to 0. Each request gets exactly one reply, in request order, with the same type and request_id. A client may send
+ * any number of requests without waiting for replies and match them up by request_id.
+ *
+ * All fields are little-endian.
+ */
+
+#include <bit>
+#include <cstdint>
+
+static_assert(std::endian::native == std::endian::little, "RPC structs are sent as-is, and the wire is little-endian");
+
+constexpr uint8_t RPC_MAGIC[4] = {0xC1, 0x0B, 0x52, 0x01};
+
+/// Largest payload of a single frame, in either direction.
+constexpr uint16_t RPC_MAX_PAYLOAD = 1024;
+
+enum class rpc_type : uint16_t {
+    /// -> (empty), <- rpc_ping_reply
+    PING = 1,
+    /// -> (empty), <- rpc_pos_reply
+    GET_POS = 2,
+    /// -> (empty), <- rpc_pts_reply
+    GET_PTS = 3,
+    /// -> rpc_pt_config_request, <- (empty)
+    SET_PT_BIAS = 4,
+    /// -> rpc_pt_config_request, <- (empty)
+    SET_PT_RANGE = 5,
+    /// -> (empty), <- rpc_pt_configs_reply
+    GET_PT_CONFIGS = 6,
+    /// -> rpc_prepare_seq_request followed by float breakpoints in degrees, <- rpc_prepare_seq_reply
+    PREPARE_SEQ = 7,
+    /// -> (empty), <- (empty). Data goes to telemetry subscribers, which need at least one. Replies once the sequence has
+    /// started.
+    START_SEQ = 8,
+    /// -> (empty), <- (empty)
+    RESET_OPEN = 9,
+    /// -> (empty), <- (empty)
+    RESET_CLOSE = 10,
+    /// -> (empty), <- (empty). Replies once homing is done.
+    CALIBRATE = 11,
+    /// -> rpc_profile_begin_request, <- (empty). Starts uploading a profile, replacing any prepared sequence.
+    PROFILE_BEGIN = 12,
+    /// -> any number of rpc_profile_point, <- (empty). Appends to the profile being uploaded. Any invalid point
+    /// abandons the upload.
+    PROFILE_DATA = 13,
+    /// -> (empty), <- rpc_prepare_seq_reply. Fails unless every announced point arrived.
+    PROFILE_END = 14,
+};
+
+enum class rpc_status : int32_t {
+    OK = 0,
+    /// Request type is not known to this firmware.
+    UNKNOWN_TYPE = 1,
+    /// Payload length doesn't match what the request type expects.
+    BAD_LENGTH = 2,
+    /// Payload is well-formed but has an out-of-range or invalid value.
+    INVALID_ARGUMENT = 3,
+    /// Request was valid but the device failed to carry it out.
+    FAILED = 4,
+};
+
+struct __attribute__((packed)) rpc_frame_header {
+    uint16_t length;
+    rpc_type type;
+    uint32_t request_id;
+    rpc_status status;
+};
+static_assert(sizeof(rpc_frame_header) == 12);
+
+struct __attribute__((packed)) rpc_ping_reply {
+    /// Device uptime when the request was handled.
+    uint64_t device_time_ns;
+};
+
+struct __attribute__((packed)) rpc_pos_reply {
+    float pos_deg;
+    int32_t pos_steps;
+};
+
+struct __attribute__((packed)) rpc_pts_reply {
+    float pt102;
+    float pt202;
+    float pt203;
+    float ptf401;
+};
+
+/// Index of each PT in rpc_pt_config_request and rpc_pt_configs_reply.
+enum class rpc_pt : uint8_t {
+    PT102 = 0,
+    PT202 = 1,
+    PT203 = 2,
+    PTF401 = 3,
+};
+constexpr int RPC_NUM_PTS = 4;
+
+struct __attribute__((packed)) rpc_pt_config_request {
+    rpc_pt pt;
+    uint8_t reserved[3];
+    float value;
+};
+
+struct __attribute__((packed)) rpc_pt_configs_reply {
+    struct __attribute__((packed)) {
+        float bias;
+        float range;
+    } pts[RPC_NUM_PTS];
+};
+
+struct __attribute__((packed)) rpc_prepare_seq_request {
+    uint32_t gap_ms;
+    // Followed by (length - sizeof(rpc_prepare_seq_request)) / sizeof(float) breakpoints.
+};
+
+struct __attribute__((packed)) rpc_prepare_seq_reply {
+    uint32_t duration_ms;
+};
+
+struct __attribute__((packed)) rpc_profile_begin_request {
+    /// Points to follow, not counting the valve's starting position.
+    uint32_t num_points;
+};
+
+/// The valve moves from the previous point to target_deg over duration_ms, along a monotone cubic through the points.
+/// It moves linearly if the firmware is built without GNC_PROFILE_SMOOTH, and on any segment where the cubic would
+/// outrun the valve. Under pressure control, target_deg is a chamber pressure in psi instead.
+struct __attribute__((packed)) rpc_profile_point {
+    uint32_t duration_ms;
+    float target_deg;
+};
+
+/// Most points a single PROFILE_DATA frame can carry.
+constexpr int RPC_MAX_PROFILE_POINTS_PER_FRAME = RPC_MAX_PAYLOAD / sizeof(rpc_profile_point);
+
+#endif //CLOVER_GNC_RPC_PROTOCOL_H
@@ -0,0 +1,84 @@
+#ifndef CLOVER_GNC_TELEMETRY_FORMAT_H
+#define CLOVER_GNC_TELEMETRY_FORMAT_H
+
+/*
+ * Wire formats of telemetry. This header has no Zephyr dependencies so host tools can include it directly.
+ *
+ * Over TCP, telemetry is text. A sequence is TELEMETRY_SEQ_START_MARKER, TELEMETRY_CSV_HEADER, one CSV row per
+ * telemetry_sample with the fields in struct order, then TELEMETRY_SEQ_END_MARKER. A live stream is the same between
+ * the STREAM markers. Replies to commands on the same connection may fall between lines.
+ *
+ * Over UDP, telemetry is binary. Each datagram is a telemetry_datagram_header, followed by a telemetry_sample if the
+ * kind is SAMPLE. Samples come from either a sequence or a live stream, according to the last START datagram.
+ * `sequence` counts up by one for every sample or marker the device sends. Every destination gets the same number for
+ * the same frame, so a receiver finds lost or reordered datagrams from gaps in it. `send_failures` counts datagrams the
+ * device failed to hand to the network stack, so the receiver can tell losses on the device from losses on the wire.
+ *
+ * All fields are little-endian.
+ */
+
+#include <bit>
+#include <cstdint>
+#include <string_view>
+
+static_assert(std::endian::native == std::endian::little,
+              "Telemetry structs are sent as-is, and the wire is little-endian");
+
+constexpr uint32_t TELEMETRY_MAGIC = 0x4D544C43; // "CLTM"
+constexpr uint16_t TELEMETRY_VERSION = 2;
+
+enum class telemetry_kind : uint16_t {
+    /// A sequence is starting. No body.
+    SEQUENCE_START = 1,
+    /// One control iteration. Followed by a telemetry_sample.
+    SAMPLE = 2,
+    /// The sequence has ended. No body.
+    SEQUENCE_END = 3,
+    /// A live stream is starting. Samples follow as for a sequence. No body.
+    STREAM_START = 4,
+    /// The live stream has ended. No body.
+    STREAM_END = 5,
+};
+
+struct __attribute__((packed)) telemetry_datagram_header {
+    uint32_t magic;
+    uint16_t version;
+    telemetry_kind kind;
+    /// Frame number, shared by every destination's copy of the frame.
+    uint32_t sequence;
+    /// Device uptime when the datagram was sent.
+    uint64_t device_time_ns;
+    /// Datagrams the device has failed to send since boot.
+    uint32_t send_failures;
+};
+
+/// Data that ought be logged for each control loop iteration.
+struct __attribute__((packed)) telemetry_sample {
+    /// Seconds since the start of the sequence or stream.
+    float time;
+    uint32_t queue_size;
+    float motor_target;
+    float motor_pos;
+    float motor_velocity;
+    float motor_acceleration;
+    uint64_t motor_nsec_per_pulse;
+    float pt202;
+    float pt203;
+    float ptf401;
+    /// Chamber pressure setpoint in psi under pressure control, and NaN otherwise. motor_target is then the valve angle
+    /// the controller commanded to reach it.
+    float pressure_target;
+};
+
+constexpr std::string_view TELEMETRY_SEQ_START_MARKER = ">>>>SEQ START<<<<\n";
+constexpr std::string_view TELEMETRY_SEQ_END_MARKER = ">>>>SEQ END<<<<\n";
+constexpr std::string_view TELEMETRY_STREAM_START_MARKER = ">>>>STREAM START<<<<\n";
+constexpr std::string_view TELEMETRY_STREAM_END_MARKER = ">>>>STREAM END<<<<\n";
+constexpr std::string_view TELEMETRY_CSV_HEADER =
+        "time,queue_size,motor_target,motor_pos,motor_velocity,motor_acceleration,motor_nsec_per_pulse,"
+        "pt202,pt203,ptf401,pressure_target\n";
+
+static_assert(sizeof(telemetry_datagram_header) == 24);
+static_assert(sizeof(telemetry_sample) == 48);
+
+#endif //CLOVER_GNC_TELEMETRY_FORMAT_H
@@ -0,0 +1,69 @@
+#include "boot.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <cstdint>
+#include <iterator>
+
+LOG_MODULE_REGISTER(boot, CONFIG_LOG_DEFAULT_LEVEL);
+
+struct stage_timing {
+    uint32_t begin_us;
+    uint32_t end_us;
+    int err;
+    bool begun;
+    bool ended;
+};
+
+static constexpr const char *STAGE_NAMES[] = {
+        "kernel",
+        "console",
+        "throttle_valve",
+        "pts",
+        "telemetry",
+        "settings",
+        "server",
+};
+static_assert(std::size(STAGE_NAMES) == static_cast<size_t>(boot_stage::COUNT));
+
+/// The kernel stage begins at time zero by definition.
+static stage_timing timings[static_cast<int>(boot_stage::COUNT)] = {
+        {.begin_us = 0, .begun = true},
+};
+
+/// Microseconds since the kernel started. Time spent in the boot ROM and before the kernel clock starts isn't counted.
+static uint32_t uptime_us() {
+    return static_cast<uint32_t>(k_cyc_to_us_floor64(k_cycle_get_64()));
+}
+
+/// Timestamps the start of a boot stage. Stages on different threads may overlap.
+void boot_stage_begin(boot_stage stage) {
+    stage_timing &timing = timings[static_cast<int>(stage)];
+    timing.begin_us = uptime_us();
+    timing.begun = true;
+}
+
+/// Timestamps the end of a boot stage, with its result.
+void boot_stage_end(boot_stage stage, int err) {
+    stage_timing &timing = timings[static_cast<int>(stage)];
+    timing.end_us = uptime_us();
+    timing.err = err;
+    timing.ended = true;
+    LOG_INF("Boot stage %s done at %u us, took %u us, err %d", STAGE_NAMES[static_cast<int>(stage)], timing.end_us,
+            timing.end_us - timing.begin_us, err);
+}
+
+/// Formats every stage's timing, as offsets from kernel start, for the boottime command.
+void boot_report(ReplyBuffer &reply) {
+    for (int i = 0; i < static_cast<int>(boot_stage::COUNT); ++i) {
+        const stage_timing &timing = timings[i];
+        if (!timing.begun) {
+            reply.appendf("%s: not started\n", STAGE_NAMES[i]);
+        } else if (!timing.ended) {
+            reply.appendf("%s: started at %u us, not done\n", STAGE_NAMES[i], timing.begin_us);
+        } else {
+            reply.appendf("%s: %u us to %u us (%u us), err %d\n", STAGE_NAMES[i], timing.begin_us, timing.end_us,
+                          timing.end_us - timing.begin_us, timing.err);
+        }
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef CLOVER_BOOT_H
+#define CLOVER_BOOT_H
+
+#include "reply_buffer.h"
+
+/// Steps of bringing up the controller, in roughly the order they start. Some run in parallel.
+enum class boot_stage {
+    /// From kernel start until main() is entered.
+    KERNEL,
+    CONSOLE,
+    THROTTLE_VALVE,
+    PTS,
+    TELEMETRY,
+    /// Loading calibration and valve position from flash.
+    SETTINGS,
+    /// Until the command server is accepting connections.
+    SERVER,
+    COUNT,
+};
+
+void boot_stage_begin(boot_stage stage);
+
+void boot_stage_end(boot_stage stage, int err);
+
+void boot_report(ReplyBuffer &reply);
+
+#endif //CLOVER_BOOT_H
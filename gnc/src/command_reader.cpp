@@ -0,0 +1,68 @@
+#include "command_reader.h"
+
+#include <zephyr/net/socket.h>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+/// Receives as many bytes as are available and fit in the buffer, blocking until at least one arrives. Returns the
+/// number of bytes read, 0 if the peer closed the connection, or a negative errno.
+int CommandReader::fill(int sock) {
+    compact();
+    if (len == MAX_COMMAND_LEN) {
+        return -ENOBUFS;
+    }
+    ssize_t bytes_read = zsock_recv(sock, buf + len, MAX_COMMAND_LEN - len, 0);
+    if (bytes_read < 0) {
+        return -errno;
+    }
+    len += static_cast<int>(bytes_read);
+    return static_cast<int>(bytes_read);
+}
+
+/// Scans buffered bytes for the next complete command. On success, `command` views the command, including its `#`
+/// terminator and without whitespace, and stays valid until the next call to fill or next.
+bool CommandReader::next(std::string_view &command) {
+    compact();
+    while (scanned < len) {
+        char c = buf[scanned++];
+        // Ignore whitespace
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            continue;
+        }
+        buf[command_len++] = c;
+        if (c == '#') {
+            command = std::string_view{buf, static_cast<size_t>(command_len)};
+            consumed = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Whether the buffered command has hit MAX_COMMAND_LEN without a terminator, so no further bytes can be read.
+bool CommandReader::full() const {
+    return command_len == MAX_COMMAND_LEN;
+}
+
+/// Discards all buffered bytes, for reuse on a new connection.
+void CommandReader::reset() {
+    len = 0;
+    scanned = 0;
+    command_len = 0;
+    consumed = false;
+}
+
+/// Drops a handed-out command and packs unscanned bytes up against the partial command, freeing space at the end.
+void CommandReader::compact() {
+    if (consumed) {
+        command_len = 0;
+        consumed = false;
+    }
+    if (command_len == scanned) {
+        return;
+    }
+    std::memmove(buf + command_len, buf + scanned, len - scanned);
+    len -= scanned - command_len;
+    scanned = command_len;
+}
@@ -0,0 +1,35 @@
+#ifndef CLOVER_COMMAND_READER_H
+#define CLOVER_COMMAND_READER_H
+
+#include <string_view>
+
+/// Buffers bytes received on a client connection and splits them into `#`-terminated commands. Any number of commands
+/// may arrive in one read, and a partial command carries over to the next read.
+class CommandReader {
+public:
+    static constexpr int MAX_COMMAND_LEN = 512;
+
+    int fill(int sock);
+
+    bool next(std::string_view &command);
+
+    bool full() const;
+
+    void reset();
+
+private:
+    char buf[MAX_COMMAND_LEN];
+    /// Bytes in buf.
+    int len = 0;
+    /// Bytes of buf already scanned. buf[0, command_len) holds the command scanned so far, with whitespace removed,
+    /// and buf[scanned, len) holds bytes not yet scanned.
+    int scanned = 0;
+    int command_len = 0;
+    /// Whether the command in buf[0, command_len) was handed out and should be dropped.
+    bool consumed = false;
+
+    void compact();
+};
+
+
+#endif //CLOVER_COMMAND_READER_H
@@ -0,0 +1,665 @@
+#include "commands.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include "boot.h"
+#include "gnc_trace.h"
+#include "throttle_valve.h"
+#include "pressure_control.h"
+#include "pts.h"
+#include "redline.h"
+#include "sequencer.h"
+#include "stats.h"
+#include "telemetry.h"
+
+LOG_MODULE_REGISTER(commands, CONFIG_LOG_DEFAULT_LEVEL);
+
+/// Longest text from a client that is logged. Anything longer is cut short.
+constexpr size_t MAX_LOGGED_TEXT = 96;
+
+/// Copies text into buf as a null-terminated string, cut to fit, for logging with %s. Deferred logging copies %s
+/// arguments with strlen and ignores any precision, so a view into the receive buffer can't be logged with %.*s.
+static const char *loggable(std::string_view text, char (&buf)[MAX_LOGGED_TEXT + 1]) {
+    size_t len = std::min(text.size(), MAX_LOGGED_TEXT);
+    memcpy(buf, text.data(), len);
+    buf[len] = '\0';
+    return buf;
+}
+
+/// Handles one command. `args` is everything after the command name, excluding the `#` terminator. Any reply is
+/// appended to ctx.reply, which the dispatcher sends once the handler returns.
+using command_handler = void (*)(client_context &ctx, std::string_view args);
+
+static void handle_calibrate(client_context &ctx, std::string_view) {
+    int err = throttle_valve_start_calibrate();
+    if (err) {
+        ctx.reply.appendf("Failed to calibrate: err %d\n", err);
+        return;
+    }
+    ctx.reply.append("Done calibrating\n");
+}
+
+static void handle_resetopen(client_context &ctx, std::string_view) {
+    // Sets the current position as 90 deg WITHOUT moving the valve.
+    throttle_valve_set_open();
+    ctx.reply.append("Done reset open\n");
+}
+
+static void handle_resetclose(client_context &ctx, std::string_view) {
+    // Sets the current position as 0 deg WITHOUT moving the valve.
+    throttle_valve_set_closed();
+    ctx.reply.append("Done reset close\n");
+}
+
+/// Parses all of str as a number.
+template<typename T>
+static bool parse_number(std::string_view str, T &value) {
+    auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+    return ec == std::errc{} && end == str.data() + str.size() && !str.empty();
+}
+
+/// Splits off the next field of str, up to the separator, and returns it.
+static std::string_view next_field(std::string_view &str, char separator) {
+    size_t end = str.find(separator);
+    std::string_view field = str.substr(0, end);
+    str.remove_prefix(end == std::string_view::npos ? str.size() : end + 1);
+    return field;
+}
+
+static void handle_seq(client_context &ctx, std::string_view args) {
+    // Example: seq500;75.5,52.0,70,90, where 500 -> 500ms between each breakpoint and
+    // the commas-seperated values are the breakpoints in degrees.
+    // NOTE: An initial breakpoint, representing the valve current starting position,
+    // is implicitly added. Thus, the example shown will run for 2s as we actually start
+    // at, say, 90 deg.
+    // Longer profiles, or ones with uneven gaps, are uploaded with profbegin/profdata/profend.
+
+    std::array<float, SEQUENCER_MAX_BREAKPOINTS> seq_breakpoints;
+    int num_breakpoints = 0;
+    seq_breakpoints[num_breakpoints++] = throttle_valve_get_pos();
+
+    int gap = 0;
+    if (!parse_number(next_field(args, ';'), gap) || gap <= 0) {
+        ctx.reply.append("Invalid gap\n");
+        return;
+    }
+    while (!args.empty()) {
+        if (num_breakpoints == std::ssize(seq_breakpoints)) {
+            ctx.reply.appendf("Too many breakpoints, max is %d\n", SEQUENCER_MAX_BREAKPOINTS);
+            return;
+        }
+        std::string_view field = next_field(args, ',');
+        if (!parse_number(field, seq_breakpoints[num_breakpoints])) {
+            ctx.reply.appendf("Invalid breakpoint: %.*s\n", static_cast<int>(field.size()), field.data());
+            return;
+        }
+        num_breakpoints += 1;
+    }
+
+    if (num_breakpoints <= 1) {
+        ctx.reply.append("Breakpoints too short\n");
+        return;
+    }
+    if (sequencer_prepare(gap, std::span<const float>{seq_breakpoints.data(), static_cast<size_t>(num_breakpoints)})) {
+        ctx.reply.append("Failed to prepare sequence\n");
+        return;
+    }
+    ctx.reply.appendf("Breakpoints prepared, length is: %dms\n", sequencer_get_duration_ms());
+}
+
+/// `profbegin<count>#` starts uploading a profile of <count> points. They follow in any number of profdata commands,
+/// and profend# finishes the upload.
+static void handle_profbegin(client_context &ctx, std::string_view args) {
+    int length = 0;
+    if (!parse_number(args, length) || sequencer_profile_begin(length)) {
+        ctx.reply.appendf("Invalid profile length, max is %d\n", SEQUENCER_MAX_PROFILE_POINTS);
+        return;
+    }
+    ctx.reply.append("Profile upload started\n");
+}
+
+/// `profdata<ms>,<deg>;<ms>,<deg>;...#` appends points to the profile being uploaded. Each moves the valve to <deg>
+/// over <ms> from the previous point. Replies only on error, so a client can stream chunks without waiting.
+static void handle_profdata(client_context &ctx, std::string_view args) {
+    constexpr int MAX_CHUNK_POINTS = CommandReader::MAX_COMMAND_LEN / 4;
+    std::array<profile_point, MAX_CHUNK_POINTS> points;
+    int num_points = 0;
+    while (!args.empty()) {
+        std::string_view point = next_field(args, ';');
+        std::string_view duration = next_field(point, ',');
+        // None of this chunk is appended, so profend# will find points missing.
+        if (num_points == MAX_CHUNK_POINTS || !parse_number(duration, points[num_points].duration_ms) ||
+            !parse_number(point, points[num_points].target_deg)) {
+            ctx.reply.append("Invalid profile point\n");
+            return;
+        }
+        num_points += 1;
+    }
+    if (sequencer_profile_append(std::span<const profile_point>{points.data(), static_cast<size_t>(num_points)})) {
+        ctx.reply.append("Invalid profile data, upload abandoned\n");
+    }
+}
+
+static void handle_profend(client_context &ctx, std::string_view) {
+    if (sequencer_profile_end()) {
+        ctx.reply.append("Profile upload incomplete\n");
+        return;
+    }
+    ctx.reply.appendf("Profile prepared, length is: %dms\n", sequencer_get_duration_ms());
+}
+
+/// `pressurectl<kp>,<ki>,<kd>#` runs the prepared sequence, from seq or a profile upload, under closed-loop chamber
+/// pressure control with these gains. Its breakpoints are then pressures in psi rather than angles. Gains are in deg
+/// per psi, deg per psi-second and deg per psi/s.
+static void handle_pressurectl(client_context &ctx, std::string_view args) {
+    pressure_gains gains = {};
+    if (!parse_number(next_field(args, ','), gains.kp) || !parse_number(next_field(args, ','), gains.ki) ||
+        !parse_number(args, gains.kd)) {
+        ctx.reply.append("Invalid gains, expected <kp>,<ki>,<kd>\n");
+        return;
+    }
+    if (sequencer_set_pressure_control(gains)) {
+        ctx.reply.append("Failed to set pressure control\n");
+        return;
+    }
+    ctx.reply.appendf("Pressure control set, kp=%f, ki=%f, kd=%f\n", static_cast<double>(gains.kp),
+                      static_cast<double>(gains.ki), static_cast<double>(gains.kd));
+}
+
+/// `pctable<psi>,<deg>;<psi>,<deg>;...#` replaces the valve characteristic that pressure control takes its feedforward
+/// from: the angle at which the chamber settles at each pressure, rising in both. `pctable#` shows the current one.
+static void handle_pctable(client_context &ctx, std::string_view args) {
+    if (!args.empty()) {
+        std::array<valve_characteristic_point, PRESSURE_CONTROL_MAX_CHARACTERISTIC_POINTS> points;
+        int num_points = 0;
+        while (!args.empty()) {
+            std::string_view point = next_field(args, ';');
+            std::string_view psi = next_field(point, ',');
+            if (num_points == std::ssize(points) || !parse_number(psi, points[num_points].chamber_psi) ||
+                !parse_number(point, points[num_points].valve_deg)) {
+                ctx.reply.append("Invalid valve characteristic point\n");
+                return;
+            }
+            num_points += 1;
+        }
+        if (pressure_control_set_characteristic(
+                    std::span<const valve_characteristic_point>{points.data(), static_cast<size_t>(num_points)})) {
+            ctx.reply.append("Failed to set valve characteristic\n");
+            return;
+        }
+    }
+    for (const valve_characteristic_point &point : pressure_control_get_characteristic()) {
+        ctx.reply.appendf("%f psi: %f deg\n", static_cast<double>(point.chamber_psi),
+                          static_cast<double>(point.valve_deg));
+    }
+}
+
+static void handle_getpos(client_context &ctx, std::string_view) {
+    ctx.reply.appendf("valve pos: %f deg\n", static_cast<double>(throttle_valve_get_pos()));
+}
+
+static void handle_getpts(client_context &ctx, std::string_view) {
+    pt_readings readings;
+    if (pts_sample(readings)) {
+        ctx.reply.append("PT acquisition stopped\n");
+        return;
+    }
+    ctx.reply.appendf("pt203: %f, pt202: %f, ptf401: %f, pt102: %f\n", static_cast<double>(readings.pt203),
+                      static_cast<double>(readings.pt202), static_cast<double>(readings.ptf401),
+                      static_cast<double>(readings.pt102));
+}
+
+static void handle_start(client_context &ctx, std::string_view) {
+    // The DAQ waits for the ACK before reading sequence data, so it has to go out before the sequence starts.
+    ctx.reply.append("ACK#");
+    int err = ctx.reply.flush(ctx.socket);
+    if (err) {
+        LOG_ERR("Failed to send ACK: err %d", err);
+    }
+    // Triggered in DAQ sequencer.
+    LOG_INF("Triggering sequence from DAQ.");
+    err = sequencer_start_trace();
+    if (err) {
+        LOG_ERR("Failed to run sequence: err %d", err);
+    }
+}
+
+/// `listen#` subscribes to sequence data, skipping records whenever this client falls behind. `listen<N>#` sends only
+/// every Nth record instead, for slow links. The subscription lasts until `unlisten#` or disconnect.
+static void handle_listen(client_context &ctx, std::string_view args) {
+    int err;
+    if (args.empty()) {
+        err = telemetry_subscribe(ctx.socket, telemetry_policy::DROP, 1);
+    } else {
+        int decimation = 0;
+        if (!parse_number(args, decimation)) {
+            ctx.reply.append("Invalid decimation\n");
+            return;
+        }
+        err = telemetry_subscribe(ctx.socket, telemetry_policy::DECIMATE, decimation);
+    }
+    if (err) {
+        ctx.reply.append("Failed to subscribe\n");
+        return;
+    }
+    ctx.reply.append("Don't send additional commands till the sequence is done, lest the output be mangled.\n");
+    ctx.reply.append("Listening for sequence...\n");
+}
+
+/// `listenudp<port>#` subscribes to sequence data as datagrams sent to <port> on this client's address. See
+/// gnc/telemetry_format.h.
+static void handle_listenudp(client_context &ctx, std::string_view args) {
+    uint16_t port = 0;
+    if (!parse_number(args, port) || port == 0) {
+        ctx.reply.append("Invalid port\n");
+        return;
+    }
+    int err = telemetry_subscribe_udp(ctx.socket, port);
+    if (err == -ENOTSUP) {
+        ctx.reply.append("UDP telemetry is not enabled\n");
+        return;
+    }
+    if (err) {
+        ctx.reply.append("Failed to subscribe\n");
+        return;
+    }
+    ctx.reply.appendf("Sending sequence data to UDP port %u\n", port);
+}
+
+static void handle_unlisten(client_context &ctx, std::string_view) {
+    telemetry_unsubscribe(ctx.socket);
+    ctx.reply.append("No longer listening\n");
+}
+
+/// Subscribes the client to telemetry if it isn't already, keeping any policy it chose with listen.
+static int ensure_subscribed(client_context &ctx) {
+    if (telemetry_is_subscribed(ctx.socket)) {
+        return 0;
+    }
+    return telemetry_subscribe(ctx.socket, telemetry_policy::DROP, 1);
+}
+
+static void handle_dstart(client_context &ctx, std::string_view) {
+    // Triggered manually. Sequence data follows on this connection, ending with the SEQ END marker.
+    int err = ensure_subscribed(ctx);
+    if (err == 0) {
+        err = sequencer_start_trace();
+    }
+    if (err) {
+        LOG_ERR("Failed to run sequence: err %d", err);
+        ctx.reply.append("Failed to run sequence\n");
+    }
+}
+
+/// `stream<hz>#` streams PT and valve samples to the telemetry subscribers at <hz>, from 1 to 1000, until
+/// stopstream#. The requesting client is subscribed if it isn't already. Samples are framed by STREAM START and
+/// STREAM END markers rather than SEQ ones, and otherwise look like sequence data.
+static void handle_stream(client_context &ctx, std::string_view args) {
+    int rate_hz = 0;
+    if (!parse_number(args, rate_hz) || rate_hz < 1 || rate_hz > SEQUENCER_MAX_STREAM_HZ) {
+        ctx.reply.appendf("Invalid rate, must be 1 to %d Hz\n", SEQUENCER_MAX_STREAM_HZ);
+        return;
+    }
+    if (ensure_subscribed(ctx) || sequencer_start_stream(rate_hz)) {
+        ctx.reply.append("Failed to start streaming\n");
+    }
+}
+
+static void handle_stopstream(client_context &ctx, std::string_view) {
+    if (sequencer_stop_stream()) {
+        ctx.reply.append("Not streaming\n");
+    }
+}
+
+/// Replies with the device's uptime, so clients can measure round trips and line up device and host clocks.
+static void handle_ping(client_context &ctx, std::string_view) {
+    ctx.reply.appendf("pong %llu\n", k_cyc_to_ns_floor64(k_cycle_get_64()));
+}
+
+/// Reports how long each stage of boot took.
+static void handle_boottime(client_context &ctx, std::string_view) {
+    boot_report(ctx.reply);
+}
+
+/// Reports CPU, stack and net pool usage. The report is long, so it goes out in parts as it is written.
+static void handle_stats(client_context &ctx, std::string_view) {
+    int err = stats_report(ctx.reply, ctx.socket);
+    if (err) {
+        LOG_ERR("Failed to send stats: err %d", err);
+    }
+}
+
+#ifdef CONFIG_GNC_TRACE
+/// Starts recording a timeline, discarding the last one.
+static void handle_tracestart(client_context &ctx, std::string_view) {
+    gnc_trace_start();
+    ctx.reply.append("Tracing\n");
+}
+
+/// Stops recording, keeping the timeline for tracedump.
+static void handle_tracestop(client_context &ctx, std::string_view) {
+    gnc_trace_stop();
+    ctx.reply.append("Stopped tracing\n");
+}
+
+/// Sends the recorded timeline, as a CTF trace. See gnc_trace_dump for the format.
+static void handle_tracedump(client_context &ctx, std::string_view) {
+    gnc_trace_dump(ctx.socket);
+}
+#else
+static void handle_tracestart(client_context &ctx, std::string_view) {
+    ctx.reply.append("Tracing not built in, see tracing.conf\n");
+}
+
+static void handle_tracestop(client_context &ctx, std::string_view args) {
+    handle_tracestart(ctx, args);
+}
+
+static void handle_tracedump(client_context &ctx, std::string_view args) {
+    handle_tracestart(ctx, args);
+}
+#endif
+
+/// Maps a PT name to its index in pt_configs, or -1 if unknown.
+static int pt_index_by_name(std::string_view pt_name) {
+    for (int i = 0; i < NUM_PTS; ++i) {
+        if (pt_name == pts_name(i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/// Parses `,<pt name>,<value>` as sent after configptbias and configptrang.
+static bool parse_pt_config_args(std::string_view args, int &pt_index, float &value) {
+    if (args.starts_with(',')) {
+        args.remove_prefix(1);
+    }
+    size_t comma = args.find(',');
+    if (comma == std::string_view::npos) {
+        LOG_ERR("Missing PT config value");
+        return false;
+    }
+    std::string_view pt_name = args.substr(0, comma);
+    std::string_view value_str = args.substr(comma + 1);
+
+    pt_index = pt_index_by_name(pt_name);
+    if (pt_index < 0) {
+        char name_buf[MAX_LOGGED_TEXT + 1];
+        LOG_ERR("Invalid pt name: %s", loggable(pt_name, name_buf));
+        return false;
+    }
+    if (!parse_number(value_str, value)) {
+        char value_buf[MAX_LOGGED_TEXT + 1];
+        LOG_ERR("Invalid PT config value: %s", loggable(value_str, value_buf));
+        return false;
+    }
+    return true;
+}
+
+static void handle_configptbias(client_context &ctx, std::string_view args) {
+    // Configure the pt bias as such:
+    // configptbias,pt203,-5#
+    int pt_index = 0;
+    float value = 0;
+    if (!parse_pt_config_args(args, pt_index, value)) {
+        return;
+    }
+    int err = pts_set_bias(pt_index, value);
+    if (err) {
+        LOG_ERR("Failed to set PT bias: err %d", err);
+        return;
+    }
+    ctx.reply.append("Set PT bias.");
+}
+
+static void handle_configptrang(client_context &ctx, std::string_view args) {
+    // Set the PT range (e.g., 1k PT) as such:
+    // configptrang,pt203,2000#
+    int pt_index = 0;
+    float value = 0;
+    if (!parse_pt_config_args(args, pt_index, value)) {
+        return;
+    }
+    int err = pts_set_range(pt_index, value);
+    if (err) {
+        LOG_ERR("Failed to set PT range: err %d", err);
+        return;
+    }
+    ctx.reply.append("Set PT bias.");
+}
+
+static void handle_getptconfigs(client_context &ctx, std::string_view) {
+    for (int i = 0; i < NUM_PTS; ++i) {
+        ctx.reply.appendf("%s: bias=%fpsig, range=%fpsig\n", pts_name(i), static_cast<double>(pt_configs[i].bias),
+                          static_cast<double>(pt_configs[i].range));
+    }
+}
+
+/// Appends every redline and the last trip.
+static void report_redlines(client_context &ctx) {
+    for (int i = 0; i < NUM_PTS; ++i) {
+        pt_redline limits = redline_get_pt(i);
+        if (!limits.enabled) {
+            ctx.reply.appendf("%s: off\n", pts_name(i));
+            continue;
+        }
+        ctx.reply.appendf("%s: %f to %f psi, %f psi/s\n", pts_name(i), static_cast<double>(limits.min_psi),
+                          static_cast<double>(limits.max_psi), static_cast<double>(limits.max_rate_psi_per_s));
+    }
+    valve_redline valve = redline_get_valve();
+    ctx.reply.appendf("valve: tracking %f deg, safe at %f deg\n", static_cast<double>(valve.max_tracking_deg),
+                      static_cast<double>(valve.safe_deg));
+
+    redline_trip trip = redline_last_trip();
+    if (trip.limit == redline_limit::NONE) {
+        ctx.reply.append("last sequence: no trip\n");
+        return;
+    }
+    ctx.reply.appendf("last sequence: %s on %s at %f, safe position commanded after %u us\n",
+                      redline_limit_name(trip.limit), redline_trip_source(trip), static_cast<double>(trip.value),
+                      trip.latency_us);
+}
+
+/// `redline,<pt>,<min psi>,<max psi>,<max psi/s>#` sets a PT's redlines, where a rate of 0 is no rate limit.
+/// `redline,<pt>#` clears them, and `redline#` shows them all, with what tripped in the last sequence. Changes apply
+/// from the next sequence.
+static void handle_redline(client_context &ctx, std::string_view args) {
+    if (args.starts_with(',')) {
+        args.remove_prefix(1);
+        std::string_view pt_name = next_field(args, ',');
+        int pt_index = pt_index_by_name(pt_name);
+        if (pt_index < 0) {
+            ctx.reply.appendf("Invalid pt name: %.*s\n", static_cast<int>(pt_name.size()), pt_name.data());
+            return;
+        }
+        pt_redline limits = {};
+        if (!args.empty()) {
+            limits.enabled = true;
+            if (!parse_number(next_field(args, ','), limits.min_psi) ||
+                !parse_number(next_field(args, ','), limits.max_psi) ||
+                !parse_number(args, limits.max_rate_psi_per_s)) {
+                ctx.reply.append("Invalid redline, expected <pt>,<min psi>,<max psi>,<max psi/s>\n");
+                return;
+            }
+        }
+        if (redline_set_pt(pt_index, limits)) {
+            ctx.reply.append("Failed to set redline\n");
+            return;
+        }
+    }
+    report_redlines(ctx);
+}
+
+/// `redlinevalve<deg>,<safe deg>#` aborts when the valve falls more than <deg> behind its command, 0 for never, and
+/// sets where any abort drives it. Changes apply from the next sequence.
+static void handle_redlinevalve(client_context &ctx, std::string_view args) {
+    valve_redline limits = {};
+    if (!parse_number(next_field(args, ','), limits.max_tracking_deg) || !parse_number(args, limits.safe_deg)) {
+        ctx.reply.append("Invalid valve redline, expected <max tracking deg>,<safe deg>\n");
+        return;
+    }
+    if (redline_set_valve(limits)) {
+        ctx.reply.append("Failed to set valve redline\n");
+        return;
+    }
+    report_redlines(ctx);
+}
+
+struct command_entry {
+    std::string_view name;
+    command_handler handler;
+};
+
+/// Every command the server understands. A command is its name, optionally followed by arguments starting with a
+/// digit, `-`, `,` or `;`, and terminated with `#`.
+static constexpr std::array COMMANDS = {
+        command_entry{"calibrate", handle_calibrate},
+        command_entry{"resetopen", handle_resetopen},
+        command_entry{"resetclose", handle_resetclose},
+        command_entry{"seq", handle_seq},
+        command_entry{"profbegin", handle_profbegin},
+        command_entry{"profdata", handle_profdata},
+        command_entry{"profend", handle_profend},
+        command_entry{"pressurectl", handle_pressurectl},
+        command_entry{"pctable", handle_pctable},
+        command_entry{"getpos", handle_getpos},
+        command_entry{"getpts", handle_getpts},
+        command_entry{"START", handle_start},
+        command_entry{"listen", handle_listen},
+        command_entry{"listenudp", handle_listenudp},
+        command_entry{"unlisten", handle_unlisten},
+        command_entry{"dstart", handle_dstart},
+        command_entry{"stream", handle_stream},
+        command_entry{"stopstream", handle_stopstream},
+        command_entry{"configptbias", handle_configptbias},
+        command_entry{"configptrang", handle_configptrang},
+        command_entry{"getptconfigs", handle_getptconfigs},
+        command_entry{"redline", handle_redline},
+        command_entry{"redlinevalve", handle_redlinevalve},
+        command_entry{"boottime", handle_boottime},
+        command_entry{"ping", handle_ping},
+        command_entry{"stats", handle_stats},
+        command_entry{"tracestart", handle_tracestart},
+        command_entry{"tracestop", handle_tracestop},
+        command_entry{"tracedump", handle_tracedump},
+};
+
+/*
+ * Commands are looked up through a perfect hash, computed at compile time: seeded FNV-1a, reduced to a slot in a
+ * table a few times larger than the command count. find_hash_seed tries seeds until every command name lands in its
+ * own slot, so a lookup is one hash, one slot read, and one string compare.
+ */
+
+constexpr int COMMAND_SLOTS = 128;
+static_assert(COMMANDS.size() < COMMAND_SLOTS, "Command table is too small for the number of commands");
+
+static constexpr uint32_t command_hash(std::string_view name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (char c : name) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+    }
+    return hash % COMMAND_SLOTS;
+}
+
+static constexpr bool is_perfect_hash_seed(uint32_t seed) {
+    std::array<bool, COMMAND_SLOTS> taken{};
+    for (const command_entry &entry: COMMANDS) {
+        uint32_t slot = command_hash(entry.name, seed);
+        if (taken[slot]) {
+            return false;
+        }
+        taken[slot] = true;
+    }
+    return true;
+}
+
+static constexpr uint32_t find_hash_seed() {
+    for (uint32_t seed = 0; seed < 1000; ++seed) {
+        if (is_perfect_hash_seed(seed)) {
+            return seed;
+        }
+    }
+    return UINT32_MAX;
+}
+
+constexpr uint32_t COMMAND_HASH_SEED = find_hash_seed();
+static_assert(COMMAND_HASH_SEED != UINT32_MAX, "No perfect hash seed for command names, increase COMMAND_SLOTS");
+
+/// Slot -> index into COMMANDS, or -1 for an empty slot.
+static constexpr std::array<int8_t, COMMAND_SLOTS> COMMAND_TABLE = [] {
+    std::array<int8_t, COMMAND_SLOTS> table{};
+    table.fill(-1);
+    for (int i = 0; i < std::ssize(COMMANDS); ++i) {
+        table[command_hash(COMMANDS[i].name, COMMAND_HASH_SEED)] = static_cast<int8_t>(i);
+    }
+    return table;
+}();
+
+/// Splits a `#`-terminated command into its name and arguments and runs its handler, then sends any reply.
+void commands_dispatch(client_context &ctx, std::string_view command) {
+    if (command.ends_with('#')) {
+        command.remove_suffix(1);
+    }
+    size_t name_len = command.find_first_of("0123456789-,;");
+    if (name_len == std::string_view::npos) {
+        name_len = command.size();
+    }
+    std::string_view name = command.substr(0, name_len);
+
+    int index = COMMAND_TABLE[command_hash(name, COMMAND_HASH_SEED)];
+    if (index < 0 || COMMANDS[index].name != name) {
+        LOG_WRN("Unknown command.");
+        return;
+    }
+
+    ctx.reply.clear();
+    COMMANDS[index].handler(ctx, command.substr(name_len));
+    int err = ctx.reply.flush(ctx.socket);
+    if (err) {
+        LOG_ERR("Failed to fully send reply: err %d", err);
+    }
+}
+
+/// Reads once from a text connection and runs every complete command. Returns 0 if the connection should stay open,
+/// or a negative errno.
+int commands_service(client_context &ctx) {
+    if (ctx.reader.full()) {
+        LOG_WRN("Didn't find command terminator `#` after %d bytes", CommandReader::MAX_COMMAND_LEN);
+        return -ENOBUFS;
+    }
+    int bytes_read = ctx.reader.fill(ctx.socket);
+    if (bytes_read < 0) {
+        LOG_WRN("Failed to read bytes: errno %d", -bytes_read);
+        return bytes_read;
+    }
+    if (bytes_read == 0) {
+        LOG_INF("Client closed connection");
+        return -ECONNRESET;
+    }
+
+    std::string_view command;
+    while (ctx.reader.next(command)) {
+        char command_buf[MAX_LOGGED_TEXT + 1];
+        LOG_INF("Got command: %s", loggable(command, command_buf));
+        commands_dispatch(ctx, command);
+    }
+    return 0;
+}
+
+/// Prepares the context for a newly accepted connection.
+void client_context::reset(int sock) {
+    socket = sock;
+    protocol = client_protocol::UNKNOWN;
+    magic_read = 0;
+    reader.reset();
+    frames.reset();
+    reply.clear();
+}
@@ -0,0 +1,38 @@
+#ifndef CLOVER_COMMANDS_H
+#define CLOVER_COMMANDS_H
+
+#include <string_view>
+
+#include "command_reader.h"
+#include "frame_reader.h"
+#include "reply_buffer.h"
+
+enum class client_protocol {
+    /// Nothing received yet.
+    UNKNOWN,
+    /// Client started sending RPC_MAGIC.
+    RPC_HANDSHAKE,
+    TEXT,
+    RPC,
+};
+
+/// State for one client connection. These live in static per-slot storage, so handling commands needs neither the
+/// heap nor much of the client thread's stack.
+struct client_context {
+    int socket = -1;
+    client_protocol protocol = client_protocol::UNKNOWN;
+    /// Bytes of RPC_MAGIC received so far.
+    int magic_read = 0;
+    CommandReader reader;
+    /// Only used if the client speaks binary RPC.
+    FrameReader frames;
+    ReplyBuffer reply;
+
+    void reset(int sock);
+};
+
+void commands_dispatch(client_context &ctx, std::string_view command);
+
+int commands_service(client_context &ctx);
+
+#endif //CLOVER_COMMANDS_H
@@ -0,0 +1,58 @@
+#include "frame_reader.h"
+
+#include <zephyr/net/socket.h>
+#include <cerrno>
+#include <cstring>
+
+/// Receives as many bytes as are available and fit in the buffer, blocking until at least one arrives. Returns the
+/// number of bytes read, 0 if the peer closed the connection, or a negative errno.
+int FrameReader::fill(int sock) {
+    compact();
+    if (len == CAPACITY) {
+        return -ENOBUFS;
+    }
+    ssize_t bytes_read = zsock_recv(sock, buf + len, CAPACITY - len, 0);
+    if (bytes_read < 0) {
+        return -errno;
+    }
+    len += static_cast<int>(bytes_read);
+    return static_cast<int>(bytes_read);
+}
+
+/// Extracts the next complete frame. `payload` stays valid until the next call to fill or next. A header announcing a
+/// payload over RPC_MAX_PAYLOAD is still returned, with an empty payload, so the caller can reject it; the connection
+/// can't be resynchronized after that.
+bool FrameReader::next(rpc_frame_header &header, std::span<const uint8_t> &payload) {
+    compact();
+    if (len < static_cast<int>(sizeof(rpc_frame_header))) {
+        return false;
+    }
+    std::memcpy(&header, buf, sizeof(rpc_frame_header));
+    if (header.length > RPC_MAX_PAYLOAD) {
+        payload = {};
+        return true;
+    }
+    int frame_len = static_cast<int>(sizeof(rpc_frame_header)) + header.length;
+    if (len < frame_len) {
+        return false;
+    }
+    payload = std::span<const uint8_t>{buf + sizeof(rpc_frame_header), header.length};
+    consumed = frame_len;
+    return true;
+}
+
+/// Discards all buffered bytes, for reuse on a new connection.
+void FrameReader::reset() {
+    len = 0;
+    consumed = 0;
+}
+
+/// Drops a handed-out frame, moving any bytes after it to the front.
+void FrameReader::compact() {
+    if (!consumed) {
+        return;
+    }
+    std::memmove(buf, buf + consumed, len - consumed);
+    len -= consumed;
+    consumed = 0;
+}
@@ -0,0 +1,32 @@
+#ifndef CLOVER_FRAME_READER_H
+#define CLOVER_FRAME_READER_H
+
+#include <cstdint>
+#include <span>
+
+#include <gnc/rpc_protocol.h>
+
+/// Buffers bytes received on a binary RPC connection and splits them into frames. Like CommandReader, any number of
+/// frames may arrive in one read, and a partial frame carries over to the next read.
+class FrameReader {
+public:
+    static constexpr int CAPACITY = sizeof(rpc_frame_header) + RPC_MAX_PAYLOAD;
+
+    int fill(int sock);
+
+    bool next(rpc_frame_header &header, std::span<const uint8_t> &payload);
+
+    void reset();
+
+private:
+    uint8_t buf[CAPACITY];
+    /// Bytes in buf.
+    int len = 0;
+    /// Size of the frame at the front of buf that was handed out and should be dropped.
+    int consumed = 0;
+
+    void compact();
+};
+
+
+#endif //CLOVER_FRAME_READER_H
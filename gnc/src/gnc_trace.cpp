@@ -0,0 +1,224 @@
+#include "gnc_trace.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/cbprintf.h>
+#include <zephyr/sys/util.h>
+#include <cstring>
+
+#include "server.h"
+
+LOG_MODULE_REGISTER(gnc_trace, CONFIG_LOG_DEFAULT_LEVEL);
+
+/*
+ * Timeline of thread switches, interrupts and app trace points, kept in a RAM ring so it always holds the most recent
+ * stretch. Kernel events arrive through Zephyr's user-defined tracing hooks.
+ *
+ * The dump is a CTF trace: metadata describing the events, then one stream of them. Every event in the ring is a
+ * fixed-size record, so the ring can wrap anywhere without losing its framing. The dump puts the name of every thread
+ * first, so viewers can label them.
+ */
+
+enum kernel_event : uint8_t {
+    THREAD_SWITCHED_IN = 0,
+    THREAD_SWITCHED_OUT = 1,
+    ISR_ENTER = 2,
+    ISR_EXIT = 3,
+    IDLE = 4,
+    /// Only in dumps, never in the ring.
+    THREAD_INFO = 5,
+};
+
+struct __attribute__((packed)) trace_record {
+    /// Hardware cycles, wrapping.
+    uint32_t timestamp;
+    uint8_t id;
+    uint8_t reserved[3];
+    int32_t arg;
+};
+static_assert(sizeof(trace_record) == 12);
+
+static trace_record ring[CONFIG_GNC_TRACE_RECORDS];
+/// Records written since the ring was last cleared. The oldest is overwritten once this passes the ring's size.
+static uint32_t written = 0;
+static volatile bool recording = false;
+
+/// Serializes dumps, which pause recording while they read the ring.
+K_MUTEX_DEFINE(dump_lock);
+
+/// Appends one record. Called from ISRs and from inside the scheduler, so this only masks interrupts briefly.
+static void record(uint8_t id, int32_t arg) {
+    if (!recording) {
+        return;
+    }
+    unsigned int key = irq_lock();
+    ring[written % CONFIG_GNC_TRACE_RECORDS] = trace_record{
+            .timestamp = k_cycle_get_32(),
+            .id = id,
+            .reserved = {},
+            .arg = arg,
+    };
+    written += 1;
+    irq_unlock(key);
+}
+
+/// Identifies a thread in the trace. Only the low 32 bits of its address, but those are unique on every target.
+static int32_t thread_id(const k_thread *thread) {
+    return static_cast<int32_t>(reinterpret_cast<uintptr_t>(thread));
+}
+
+extern "C" {
+
+void sys_trace_thread_switched_in_user() {
+    record(THREAD_SWITCHED_IN, thread_id(k_current_get()));
+}
+
+void sys_trace_thread_switched_out_user() {
+    record(THREAD_SWITCHED_OUT, thread_id(k_current_get()));
+}
+
+void sys_trace_isr_enter_user() {
+    record(ISR_ENTER, 0);
+}
+
+void sys_trace_isr_exit_user() {
+    record(ISR_EXIT, 0);
+}
+
+void sys_trace_idle_user() {
+    record(IDLE, 0);
+}
+
+}
+
+/// Records an app trace point.
+void gnc_trace(gnc_trace_event event, int32_t arg) {
+    record(static_cast<uint8_t>(event), arg);
+}
+
+/// Starts recording a new timeline, discarding the last.
+void gnc_trace_start() {
+    k_mutex_lock(&dump_lock, K_FOREVER);
+    recording = false;
+    written = 0;
+    recording = true;
+    k_mutex_unlock(&dump_lock);
+}
+
+/// Stops recording, keeping the timeline so far for dumping.
+void gnc_trace_stop() {
+    recording = false;
+}
+
+/// CTF metadata. Every event's fields are the record's arg, except for THREAD_INFO, which adds the thread's name.
+static constexpr const char METADATA_FORMAT[] = R"(/* CTF 1.8 */
+typealias integer { size = 8; align = 8; signed = false; } := uint8_t;
+typealias integer { size = 32; align = 8; signed = false; } := uint32_t;
+typealias integer { size = 32; align = 8; signed = true; } := int32_t;
+
+trace {
+    major = 1;
+    minor = 8;
+    byte_order = le;
+};
+
+clock {
+    name = cycles;
+    freq = %u;
+};
+
+typealias integer { size = 32; align = 8; signed = false; map = clock.cycles.value; } := cycles_t;
+
+stream {
+    event.header := struct {
+        cycles_t timestamp;
+        uint8_t id;
+        uint8_t reserved[3];
+    };
+};
+
+event { name = thread_switched_in; id = 0; fields := struct { uint32_t thread_id; }; };
+event { name = thread_switched_out; id = 1; fields := struct { uint32_t thread_id; }; };
+event { name = isr_enter; id = 2; fields := struct { int32_t unused; }; };
+event { name = isr_exit; id = 3; fields := struct { int32_t unused; }; };
+event { name = idle; id = 4; fields := struct { int32_t unused; }; };
+event { name = thread_info; id = 5; fields := struct { uint32_t thread_id; string name; }; };
+event { name = control_tick_start; id = 16; fields := struct { int32_t iteration; }; };
+event { name = control_tick_end; id = 17; fields := struct { int32_t iteration; }; };
+event { name = adc_start; id = 18; fields := struct { int32_t unused; }; };
+event { name = adc_done; id = 19; fields := struct { int32_t err; }; };
+event { name = pulse; id = 20; fields := struct { int32_t steps; }; };
+event { name = msgq_put; id = 21; fields := struct { int32_t queued; }; };
+event { name = msgq_get; id = 22; fields := struct { int32_t queued; }; };
+event { name = socket_send; id = 23; fields := struct { int32_t bytes; }; };
+)";
+
+/// Names of every thread, as THREAD_INFO events, ready to go ahead of the ring in a dump.
+struct thread_infos {
+    static constexpr int CAPACITY = 2048;
+    uint8_t buf[CAPACITY];
+    int len;
+};
+
+static void add_thread_info(const k_thread *thread, void *user_data) {
+    auto *infos = static_cast<thread_infos *>(user_data);
+    const char *name = k_thread_name_get(const_cast<k_thread *>(thread));
+    if (name == nullptr) {
+        name = "";
+    }
+    size_t name_len = strlen(name) + 1;
+    trace_record header = {
+            .timestamp = 0,
+            .id = THREAD_INFO,
+            .reserved = {},
+            .arg = thread_id(thread),
+    };
+    if (infos->len + sizeof(header) + name_len > thread_infos::CAPACITY) {
+        return;
+    }
+    memcpy(infos->buf + infos->len, &header, sizeof(header));
+    infos->len += sizeof(header);
+    memcpy(infos->buf + infos->len, name, name_len);
+    infos->len += static_cast<int>(name_len);
+}
+
+/// Sends the recorded timeline to sock: a `trace <metadata bytes> <stream bytes>` line, then the CTF metadata, then
+/// the CTF stream. Recording pauses while the ring is read, and resumes afterwards if it was on. Returns 0 or a
+/// negative errno.
+int gnc_trace_dump(int sock) {
+    static char metadata[sizeof(METADATA_FORMAT) + 16];
+    static thread_infos infos;
+
+    k_mutex_lock(&dump_lock, K_FOREVER);
+    bool was_recording = recording;
+    recording = false;
+
+    int metadata_len = snprintfcb(metadata, sizeof(metadata), METADATA_FORMAT,
+                                  static_cast<unsigned int>(sys_clock_hw_cycles_per_sec()));
+    infos.len = 0;
+    k_thread_foreach(add_thread_info, &infos);
+
+    uint32_t count = MIN(written, static_cast<uint32_t>(CONFIG_GNC_TRACE_RECORDS));
+    uint32_t oldest = written > CONFIG_GNC_TRACE_RECORDS ? written % CONFIG_GNC_TRACE_RECORDS : 0;
+    // The ring from its oldest record to the end of the array, then from the start of the array to the newest.
+    uint32_t first_part = MIN(count, static_cast<uint32_t>(CONFIG_GNC_TRACE_RECORDS) - oldest);
+
+    char line[48];
+    int line_len = snprintfcb(line, sizeof(line), "trace %d %u\n", metadata_len,
+                              static_cast<unsigned int>(infos.len + count * sizeof(trace_record)));
+    iovec iov[] = {
+            {.iov_base = line, .iov_len = static_cast<size_t>(line_len)},
+            {.iov_base = metadata, .iov_len = static_cast<size_t>(metadata_len)},
+            {.iov_base = infos.buf, .iov_len = static_cast<size_t>(infos.len)},
+            {.iov_base = &ring[oldest], .iov_len = first_part * sizeof(trace_record)},
+            {.iov_base = &ring[0], .iov_len = (count - first_part) * sizeof(trace_record)},
+    };
+    int err = send_iov_fully(sock, iov, ARRAY_SIZE(iov));
+
+    recording = was_recording;
+    k_mutex_unlock(&dump_lock);
+    if (err) {
+        LOG_ERR("Failed to send trace: err %d", err);
+    }
+    return err;
+}
@@ -0,0 +1,44 @@
+#ifndef CLOVER_GNC_TRACE_H
+#define CLOVER_GNC_TRACE_H
+
+#include <cstdint>
+
+/// App trace points, recorded on the same timeline as the kernel's thread switches and interrupts. Numbered after the
+/// kernel's events in the CTF metadata.
+enum class gnc_trace_event : uint8_t {
+    /// arg: control iteration number.
+    CONTROL_TICK_START = 16,
+    /// arg: control iteration number.
+    CONTROL_TICK_END,
+    /// Continuous PT acquisition started. arg: unused.
+    ADC_START,
+    /// Continuous PT acquisition stopped. arg: the driver's error.
+    ADC_DONE,
+    /// arg: valve position, in steps.
+    PULSE,
+    /// arg: samples queued after the put, or a negative errno.
+    MSGQ_PUT,
+    /// arg: samples still queued after the get.
+    MSGQ_GET,
+    /// arg: bytes sent, or a negative errno.
+    SOCKET_SEND,
+};
+
+#ifdef CONFIG_GNC_TRACE
+
+void gnc_trace(gnc_trace_event event, int32_t arg);
+
+void gnc_trace_start();
+
+void gnc_trace_stop();
+
+int gnc_trace_dump(int sock);
+
+#else
+
+/// Compiles away without tracing, so trace points cost nothing in normal builds.
+static inline void gnc_trace(gnc_trace_event, int32_t) {}
+
+#endif
+
+#endif //CLOVER_GNC_TRACE_H
@@ -0,0 +1,65 @@
+#include "heap_check.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <cstring>
+
+#include "log_limit.h"
+
+LOG_MODULE_REGISTER(heap_check, CONFIG_LOG_DEFAULT_LEVEL);
+
+/// Shortest time between repeats of the error for heap use after boot.
+constexpr uint32_t LOG_INTERVAL_MS = 1000;
+
+/*
+ * Counts heap operations, to show that the firmware stops touching the heap once it has booted. Every allocation, free
+ * and realloc in newlib takes the malloc lock first, so the link wraps __malloc_lock rather than each allocator entry
+ * point. That also catches allocations made inside libc and libstdc++, such as stdio buffers, which never pass through
+ * our code.
+ */
+
+/// Heap operations before heap_check_seal.
+static atomic_t boot_ops = ATOMIC_INIT(0);
+/// Heap operations since heap_check_seal. Should stay 0.
+static atomic_t late_ops = ATOMIC_INIT(0);
+static volatile bool sealed = false;
+/// Thread that most recently touched the heap after the seal.
+static char last_thread[CONFIG_THREAD_MAX_NAME_LEN] = "";
+
+extern "C" {
+
+struct _reent;
+
+void __real___malloc_lock(_reent *reent);
+
+void __wrap___malloc_lock(_reent *reent) {
+    if (!sealed) {
+        atomic_inc(&boot_ops);
+    } else {
+        atomic_inc(&late_ops);
+        const char *name = k_thread_name_get(k_current_get());
+        strncpy(last_thread, name != nullptr ? name : "?", sizeof(last_thread) - 1);
+        // Logging doesn't allocate, so this can't recurse.
+        LOG_ERR_LIMITED(LOG_INTERVAL_MS, "Heap used after boot, from thread %s", last_thread);
+    }
+    __real___malloc_lock(reent);
+}
+
+}
+
+/// Marks the end of boot. Any heap operation from here on is counted and logged as an error.
+void heap_check_seal() {
+    sealed = true;
+    LOG_INF("Heap sealed after %ld operations during boot", atomic_get(&boot_ops));
+}
+
+/// Appends heap operation counts from before and after the seal.
+void heap_check_report(ReplyBuffer &reply) {
+    long late = atomic_get(&late_ops);
+    reply.appendf("heap: %ld operations during boot, %ld since", atomic_get(&boot_ops), late);
+    if (late > 0) {
+        reply.appendf(" (last from %s)", last_thread);
+    }
+    reply.append("\n");
+}
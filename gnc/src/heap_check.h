@@ -0,0 +1,19 @@
+#ifndef CLOVER_HEAP_CHECK_H
+#define CLOVER_HEAP_CHECK_H
+
+#include "reply_buffer.h"
+
+#ifdef CONFIG_GNC_HEAP_CHECK
+
+void heap_check_seal();
+
+void heap_check_report(ReplyBuffer &reply);
+
+#else
+
+/// Compiles away without heap checking.
+static inline void heap_check_seal() {}
+
+#endif
+
+#endif //CLOVER_HEAP_CHECK_H
@@ -0,0 +1,37 @@
+#include "log_limit.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+/// Guards every call site's state. Held only for a few instructions, and safe to take from an ISR.
+static k_spinlock lock;
+
+/// Messages suppressed across all call sites since boot.
+static atomic_t total_suppressed = ATOMIC_INIT(0);
+
+/// Whether a rate-limited call site may log now. If so, suppressed is set to how many of its messages were dropped
+/// since it last logged.
+bool log_limit_allow(log_limit &limit, uint32_t interval_ms, uint32_t &suppressed) {
+    int64_t now = k_uptime_get();
+    bool allow;
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (now >= limit.next_ms) {
+        limit.next_ms = now + interval_ms;
+        suppressed = limit.suppressed;
+        limit.suppressed = 0;
+        allow = true;
+    } else {
+        limit.suppressed += 1;
+        allow = false;
+    }
+    k_spin_unlock(&lock, key);
+    if (!allow) {
+        atomic_inc(&total_suppressed);
+    }
+    return allow;
+}
+
+/// Messages that rate limiting has suppressed since boot, across every call site.
+uint32_t log_limit_total_suppressed() {
+    return static_cast<uint32_t>(atomic_get(&total_suppressed));
+}
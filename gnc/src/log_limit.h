@@ -0,0 +1,40 @@
+#ifndef CLOVER_LOG_LIMIT_H
+#define CLOVER_LOG_LIMIT_H
+
+#include <zephyr/logging/log.h>
+#include <cstdint>
+
+/// State for one rate-limited log call site.
+struct log_limit {
+    int64_t next_ms;
+    uint32_t suppressed;
+};
+
+bool log_limit_allow(log_limit &limit, uint32_t interval_ms, uint32_t &suppressed);
+
+uint32_t log_limit_total_suppressed();
+
+/*
+ * Rate-limited logging for paths that can fail every control tick, or in an ISR. Each call site logs at most once per
+ * interval_ms, and the next message it does log says how many were suppressed in between, so a burst of errors costs
+ * one message rather than stretching the tick that hit it.
+ */
+
+#define LOG_LIMITED(log_macro, interval_ms, fmt, ...) \
+    do { \
+        static log_limit _log_limit; \
+        uint32_t _log_suppressed; \
+        if (log_limit_allow(_log_limit, (interval_ms), _log_suppressed)) { \
+            if (_log_suppressed) { \
+                log_macro(fmt " (%u more suppressed)", ##__VA_ARGS__, _log_suppressed); \
+            } else { \
+                log_macro(fmt, ##__VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#define LOG_ERR_LIMITED(interval_ms, fmt, ...) LOG_LIMITED(LOG_ERR, interval_ms, fmt, ##__VA_ARGS__)
+
+#define LOG_WRN_LIMITED(interval_ms, fmt, ...) LOG_LIMITED(LOG_WRN, interval_ms, fmt, ##__VA_ARGS__)
+
+#endif //CLOVER_LOG_LIMIT_H
@@ -7,9 +7,12 @@
 #include <zephyr/net/socket.h>
 #include <zephyr/net/net_pkt.h>
 
+#include "boot.h"
 #include "server.h"
 #include "throttle_valve.h"
 #include "pts.h"
+#include "persist.h"
+#include "telemetry.h"
 
 extern "C" {
 #include <app/drivers/blink.h>
@@ -17,46 +20,97 @@ extern "C" {
 
 LOG_MODULE_REGISTER(main, CONFIG_LOG_DEFAULT_LEVEL);
 
-BUILD_ASSERT(DT_NODE_HAS_COMPAT(DT_CHOSEN(zephyr_console), zephyr_cdc_acm_uart),
-             "Console device is not ACM CDC UART device");
+/// The Teensy's console is USB CDC ACM, which needs USB brought up first. Elsewhere, such as on native_sim, the console
+/// is a plain UART that is ready on its own.
+#define CONSOLE_IS_CDC_ACM DT_NODE_HAS_COMPAT(DT_CHOSEN(zephyr_console), zephyr_cdc_acm_uart)
 
-int main(void) {
-    // Status LED
-    const struct device *blink = DEVICE_DT_GET(DT_NODELABEL(blink_led));
-    if (!device_is_ready(blink)) {
-        return 0;
-    }
-    blink_set_period_ms(blink, 1000u);
+#if CONSOLE_IS_CDC_ACM
+BUILD_ASSERT(IS_ENABLED(CONFIG_USB_DEVICE_STACK), "USB console needs the USB device stack");
+#endif
+
+static int pts_init_result;
+K_SEM_DEFINE(pts_init_done, 0, 1);
 
-    // Serial over USB setup
+/// PT setup touches only the ADC, so it runs on the system workqueue while main brings up everything else.
+static void init_pts(k_work *) {
+    boot_stage_begin(boot_stage::PTS);
+    LOG_INF("Initializing PTs");
+    pts_init_result = pts_init();
+    boot_stage_end(boot_stage::PTS, pts_init_result);
+    k_sem_give(&pts_init_done);
+}
+
+K_WORK_DEFINE(pts_init_work, init_pts);
+
+/// Brings up USB serial for the console, if that's what the console is. Only waits for a terminal to open it if
+/// CONFIG_GNC_WAIT_FOR_CONSOLE is set, so the controller boots headless by default.
+static int init_console() {
+#if CONSOLE_IS_CDC_ACM
     if (usb_enable(nullptr)) {
         LOG_ERR("USB is not enabled.");
-        while (1);
+        return 1;
     }
+#ifdef CONFIG_GNC_WAIT_FOR_CONSOLE
     const struct device *usb_dev = DEVICE_DT_GET(DT_CHOSEN(zephyr_console));
     uint32_t dtr = 0;
     while (!dtr) {
         uart_line_ctrl_get(usb_dev, UART_LINE_CTRL_DTR, &dtr);
         k_sleep(K_MSEC(100));
     }
+#endif
+#endif
+    return 0;
+}
+
+int main(void) {
+    boot_stage_end(boot_stage::KERNEL, 0);
+    k_work_submit(&pts_init_work);
+
+    // Status LED
+    const struct device *blink = DEVICE_DT_GET(DT_NODELABEL(blink_led));
+    if (device_is_ready(blink)) {
+        blink_set_period_ms(blink, 1000u);
+    } else {
+        LOG_WRN("Status LED is not ready");
+    }
+
+    // Serial over USB setup. Without a console, logs are lost but the controller still works.
+    boot_stage_begin(boot_stage::CONSOLE);
+    boot_stage_end(boot_stage::CONSOLE, init_console());
 
+    boot_stage_begin(boot_stage::THROTTLE_VALVE);
     LOG_INF("Initializing throttle valve");
     int err = throttle_valve_init();
+    boot_stage_end(boot_stage::THROTTLE_VALVE, err);
     if (err) {
         LOG_ERR("Failed to initialize throttle valve");
         return 0;
     }
 
-    LOG_INF("Initializing PTs");
-    err = pts_init();
+    boot_stage_begin(boot_stage::TELEMETRY);
+    LOG_INF("Initializing telemetry");
+    err = telemetry_init();
+    boot_stage_end(boot_stage::TELEMETRY, err);
     if (err) {
+        LOG_ERR("Failed to initialize telemetry");
+        return 0;
+    }
+
+    k_sem_take(&pts_init_done, K_FOREVER);
+    if (pts_init_result) {
         LOG_ERR("Failed to initialize PTs");
         return 0;
     }
 
+    // Saved calibration overrides the defaults, so it has to be in place before any client can read or change it.
+    // Without it, the controller still runs, just uncalibrated.
+    boot_stage_begin(boot_stage::SETTINGS);
+    LOG_INF("Loading settings");
+    boot_stage_end(boot_stage::SETTINGS, persist_load());
+
     LOG_INF("Starting server");
+    boot_stage_begin(boot_stage::SERVER);
     serve_connections();
 
     while (1);
 }
-
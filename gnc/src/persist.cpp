@@ -0,0 +1,291 @@
+#include "persist.h"
+
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/cbprintf.h>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+#include "pressure_control.h"
+#include "pts.h"
+#include "redline.h"
+#include "throttle_valve.h"
+
+LOG_MODULE_REGISTER(persist, CONFIG_LOG_DEFAULT_LEVEL);
+
+/*
+ * PT calibration, the valve's step position and the valve characteristic, kept in flash through the settings subsystem
+ * so the controller is ready to test straight after a power cycle. Keys live under "gnc":
+ *     gnc/pt/<pt name>           that PT's pt_calibration
+ *     gnc/valve/steps            valve position, in microsteps, as an int32_t
+ *     gnc/valve/characteristic   pressure control's valve_characteristic_points
+ *     gnc/redline/<pt name>      that PT's pt_redline
+ *     gnc/redline/valve          the valve_redline
+ *
+ * On the Teensy, code runs from the same flash that's written, so a write stalls the CPU. Saves are therefore
+ * debounced, wait for the valve to be idle, and are held off entirely while a sequence or stream runs. The stepper
+ * holds still while unpowered, so the position at the last save is still right at the next boot, unless the valve was
+ * turned by hand in between. The saved position is deleted before the valve moves under control, so power lost
+ * mid-sequence leaves no position to load rather than a stale one.
+ */
+
+/// What's saved for each PT. The scale follows from the range.
+struct pt_calibration {
+    float bias;
+    float range;
+};
+
+static constexpr const char *PT_NAMES[] = {
+        DT_FOREACH_PROP_ELEM_SEP(USER_NODE, pt_names, DT_PROP_BY_IDX, (,))
+};
+static_assert(std::size(PT_NAMES) == NUM_PTS);
+
+constexpr const char VALVE_STEPS_KEY[] = "gnc/valve/steps";
+constexpr const char CHARACTERISTIC_KEY[] = "gnc/valve/characteristic";
+constexpr const char VALVE_REDLINE_KEY[] = "gnc/redline/valve";
+
+/// Set while applying saved values, which would otherwise schedule a save of what was just loaded.
+static bool loading = false;
+/// persist_pause calls not yet matched by persist_resume. Saves wait while any are outstanding.
+static atomic_t pauses = ATOMIC_INIT(0);
+/// Whether flash holds the valve's position, so persist_pause knows if there's one to delete.
+static bool valve_steps_saved = false;
+/// Saves made by save_work since boot.
+static uint32_t debounced_saves = 0;
+
+/// Applies one saved value. name is relative to "gnc".
+static int set_setting(const char *name, size_t len, settings_read_cb read_cb, void *cb_arg) {
+    const char *next;
+    if (settings_name_steq(name, "valve/steps", &next) && next == nullptr) {
+        int32_t steps;
+        if (len != sizeof(steps)) {
+            return -EINVAL;
+        }
+        ssize_t ret = read_cb(cb_arg, &steps, sizeof(steps));
+        if (ret < 0) {
+            return static_cast<int>(ret);
+        }
+        if (throttle_valve_set_steps(steps)) {
+            return -EBUSY;
+        }
+        valve_steps_saved = true;
+        return 0;
+    }
+
+    if (settings_name_steq(name, "valve/characteristic", &next) && next == nullptr) {
+        valve_characteristic_point points[PRESSURE_CONTROL_MAX_CHARACTERISTIC_POINTS];
+        if (len % sizeof(points[0]) != 0 || len > sizeof(points)) {
+            return -EINVAL;
+        }
+        ssize_t ret = read_cb(cb_arg, points, len);
+        if (ret < 0) {
+            return static_cast<int>(ret);
+        }
+        std::span<const valve_characteristic_point> saved{points, len / sizeof(points[0])};
+        return pressure_control_set_characteristic(saved) ? -EINVAL : 0;
+    }
+
+    if (settings_name_steq(name, "redline/valve", &next) && next == nullptr) {
+        valve_redline limits;
+        if (len != sizeof(limits)) {
+            return -EINVAL;
+        }
+        ssize_t ret = read_cb(cb_arg, &limits, sizeof(limits));
+        if (ret < 0) {
+            return static_cast<int>(ret);
+        }
+        return redline_set_valve(limits) ? -EINVAL : 0;
+    }
+
+    if (settings_name_steq(name, "redline", &next) && next != nullptr) {
+        pt_redline limits;
+        if (len != sizeof(limits)) {
+            return -EINVAL;
+        }
+        for (int i = 0; i < NUM_PTS; ++i) {
+            if (strcmp(next, PT_NAMES[i]) != 0) {
+                continue;
+            }
+            ssize_t ret = read_cb(cb_arg, &limits, sizeof(limits));
+            if (ret < 0) {
+                return static_cast<int>(ret);
+            }
+            return redline_set_pt(i, limits) ? -EINVAL : 0;
+        }
+        LOG_WRN("Ignoring saved redline for unknown PT %s", next);
+        return 0;
+    }
+
+    if (settings_name_steq(name, "pt", &next) && next != nullptr) {
+        pt_calibration calibration;
+        if (len != sizeof(calibration)) {
+            return -EINVAL;
+        }
+        for (int i = 0; i < NUM_PTS; ++i) {
+            if (strcmp(next, PT_NAMES[i]) != 0) {
+                continue;
+            }
+            ssize_t ret = read_cb(cb_arg, &calibration, sizeof(calibration));
+            if (ret < 0) {
+                return static_cast<int>(ret);
+            }
+            pts_set_range(i, calibration.range);
+            pts_set_bias(i, calibration.bias);
+            return 0;
+        }
+        // Saved under a board with different PTs. Leave it be, in case the old board comes back.
+        LOG_WRN("Ignoring saved calibration for unknown PT %s", next);
+        return 0;
+    }
+
+    return -ENOENT;
+}
+
+static settings_handler handler = {
+        .name = "gnc",
+        .h_set = set_setting,
+};
+
+/// Reads saved PT calibration, valve position, valve characteristic and redlines from flash, overwriting what's in RAM.
+/// Values that were never saved keep their defaults. Must run before the server starts, while the valve is stopped.
+/// Returns 0 or a negative errno.
+int persist_load() {
+    static bool registered = false;
+    if (!registered) {
+        int err = settings_subsys_init();
+        if (err) {
+            LOG_ERR("Failed to initialize settings: err %d", err);
+            return err;
+        }
+        err = settings_register(&handler);
+        if (err) {
+            LOG_ERR("Failed to register settings handler: err %d", err);
+            return err;
+        }
+        registered = true;
+    }
+
+    loading = true;
+    int err = settings_load_subtree("gnc");
+    loading = false;
+    if (err) {
+        LOG_ERR("Failed to load settings: err %d", err);
+        return err;
+    }
+    if (valve_steps_saved) {
+        LOG_INF("Loaded settings, valve at %d steps", throttle_valve_get_steps());
+    } else {
+        LOG_WRN("Loaded settings, but no valve position. Run calibrate# or resetclose# before a sequence.");
+    }
+    return 0;
+}
+
+/// Writes every PT's calibration, the valve position, the valve characteristic and the redlines to flash now. Unchanged
+/// values cost a read, not a write. Returns 0 or a negative errno.
+int persist_save() {
+    for (int i = 0; i < NUM_PTS; ++i) {
+        char key[SETTINGS_MAX_NAME_LEN + 1];
+        snprintfcb(key, sizeof(key), "gnc/pt/%s", PT_NAMES[i]);
+        pt_calibration calibration = {
+                .bias = pt_configs[i].bias,
+                .range = pt_configs[i].range,
+        };
+        int err = settings_save_one(key, &calibration, sizeof(calibration));
+        if (err) {
+            LOG_ERR("Failed to save %s: err %d", key, err);
+            return err;
+        }
+
+        snprintfcb(key, sizeof(key), "gnc/redline/%s", PT_NAMES[i]);
+        pt_redline limits = redline_get_pt(i);
+        err = settings_save_one(key, &limits, sizeof(limits));
+        if (err) {
+            LOG_ERR("Failed to save %s: err %d", key, err);
+            return err;
+        }
+    }
+
+    int32_t steps = throttle_valve_get_steps();
+    int err = settings_save_one(VALVE_STEPS_KEY, &steps, sizeof(steps));
+    if (err) {
+        LOG_ERR("Failed to save %s: err %d", VALVE_STEPS_KEY, err);
+        return err;
+    }
+    valve_steps_saved = true;
+
+    std::span<const valve_characteristic_point> characteristic = pressure_control_get_characteristic();
+    err = settings_save_one(CHARACTERISTIC_KEY, characteristic.data(), characteristic.size_bytes());
+    if (err) {
+        LOG_ERR("Failed to save %s: err %d", CHARACTERISTIC_KEY, err);
+        return err;
+    }
+
+    valve_redline valve_limits = redline_get_valve();
+    err = settings_save_one(VALVE_REDLINE_KEY, &valve_limits, sizeof(valve_limits));
+    if (err) {
+        LOG_ERR("Failed to save %s: err %d", VALVE_REDLINE_KEY, err);
+        return err;
+    }
+    return 0;
+}
+
+static void save(k_work *work) {
+    // Never stall the CPU mid-sequence. persist_resume saves once it's over.
+    if (atomic_get(&pauses) > 0) {
+        return;
+    }
+    // Nor while the valve is moving for any other reason. Try again once it has settled.
+    if (!throttle_valve_is_idle()) {
+        k_work_reschedule(k_work_delayable_from_work(work), K_MSEC(CONFIG_GNC_SETTINGS_SAVE_DELAY_MS));
+        return;
+    }
+    persist_save();
+    debounced_saves += 1;
+}
+
+K_WORK_DELAYABLE_DEFINE(save_work, save);
+
+/// Saves once nothing has changed for CONFIG_GNC_SETTINGS_SAVE_DELAY_MS and the valve is idle, so a burst of changes
+/// costs one write. Safe to call from any thread.
+void persist_save_later() {
+    if (loading) {
+        return;
+    }
+    k_work_reschedule(&save_work, K_MSEC(CONFIG_GNC_SETTINGS_SAVE_DELAY_MS));
+}
+
+/// Holds saves off until the matching persist_resume, waiting for any save already writing, and deletes the saved valve
+/// position, which is stale from the first step. Writes flash, so call it from a thread before the valve moves.
+void persist_pause() {
+    atomic_inc(&pauses);
+    k_work_sync sync;
+    k_work_cancel_delayable_sync(&save_work, &sync);
+    if (!valve_steps_saved) {
+        return;
+    }
+    int err = settings_delete(VALVE_STEPS_KEY);
+    if (err) {
+        LOG_ERR("Failed to delete %s: err %d", VALVE_STEPS_KEY, err);
+        return;
+    }
+    valve_steps_saved = false;
+}
+
+/// Ends a persist_pause. Once none are left, schedules a save of everything that changed meanwhile, the valve position
+/// included.
+void persist_resume() {
+    if (atomic_dec(&pauses) == 1) {
+        persist_save_later();
+    }
+}
+
+#ifdef CONFIG_ZTEST
+/// Saves made by the debounced path since boot, so tests can tell how many writes a burst of changes cost.
+uint32_t persist_debounced_saves() {
+    return debounced_saves;
+}
+#endif
@@ -0,0 +1,37 @@
+#ifndef CLOVER_PERSIST_H
+#define CLOVER_PERSIST_H
+
+#include <cstdint>
+
+#ifdef CONFIG_GNC_SETTINGS
+
+int persist_load();
+
+int persist_save();
+
+void persist_save_later();
+
+void persist_pause();
+
+void persist_resume();
+
+#ifdef CONFIG_ZTEST
+uint32_t persist_debounced_saves();
+#endif
+
+#else
+
+/// Compiles away without persistence, so calibration only lasts until reboot.
+static inline int persist_load() {
+    return 0;
+}
+
+static inline void persist_save_later() {}
+
+static inline void persist_pause() {}
+
+static inline void persist_resume() {}
+
+#endif
+
+#endif //CLOVER_PERSIST_H
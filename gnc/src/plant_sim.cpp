@@ -0,0 +1,142 @@
+#include "plant_sim.h"
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/adc/adc_emul.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <algorithm>
+#include <cmath>
+
+#include "pts.h"
+
+LOG_MODULE_REGISTER(plant_sim, CONFIG_LOG_DEFAULT_LEVEL);
+
+/*
+ * Simulated throttle valve and feed system, for running sequences under native_sim with physically plausible data.
+ *
+ * The valve turns by one microstep on each step pulse the firmware puts out on the emulated PUL pin, in the direction
+ * set by the emulated DIR pin, and stalls against hard stops at 0 and 90 deg. Propellant flows from a constant-pressure
+ * tank through the feed line, the valve and the injector into the chamber:
+ *
+ *     tank (pt102) -> line -> (pt202) valve (pt203) -> injector -> chamber (ptf401)
+ *
+ * Each restriction is an orifice, dP = K * mdot^2, and chamber pressure is proportional to mass flow. The valve's K
+ * scales with the inverse square of its open area. Pressures settle towards their steady state with a first-order lag,
+ * standing in for line and manifold filling, and are written to the emulated ADC as PT output voltages.
+ *
+ * Flow is in units of the flow with the valve fully open, and the coefficients are fractions of tank pressure, chosen
+ * so that at full open the chamber sits at 70% of tank pressure.
+ */
+
+/// The simulated hardware is described independently of the firmware's idea of it: 200 step/rev motor, 20:1 gearbox,
+/// 8 microsteps.
+constexpr float DEG_PER_STEP = 360.0f / (200.0f * 20.0f * 8.0f);
+constexpr float MIN_DEG = 0.0f;
+constexpr float MAX_DEG = 90.0f;
+
+constexpr float TANK_PSI = CONFIG_GNC_PLANT_SIM_TANK_PSI;
+constexpr float K_LINE = 0.05f * TANK_PSI;
+constexpr float K_VALVE_OPEN = 0.05f * TANK_PSI;
+constexpr float K_INJECTOR = 0.20f * TANK_PSI;
+/// Chamber pressure per unit flow.
+constexpr float K_CHAMBER = 0.70f * TANK_PSI;
+
+constexpr int TICK_HZ = 1000;
+constexpr float TICK_S = 1.0f / TICK_HZ;
+constexpr float TIME_CONSTANT_S = CONFIG_GNC_PLANT_SIM_TIME_CONSTANT_MS / 1000.0f;
+
+/// PT transducers output 0 to 3300 mV over 0 to this many psi, matching the firmware's default PT range.
+constexpr float PT_FULL_SCALE_PSI = 1000.0f;
+constexpr float PT_FULL_SCALE_MV = 3300.0f;
+
+static const struct gpio_dt_spec pul_gpio = GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), stepper_pul_gpios);
+static const struct gpio_dt_spec dir_gpio = GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), stepper_dir_gpios);
+
+static volatile float valve_deg = CONFIG_GNC_PLANT_SIM_INITIAL_DEG;
+static int last_pul = 0;
+static pt_readings pressures;
+
+/// Called by the firmware's step pulse ISR after each PUL edge. The driver sits behind an inverting converter, so it
+/// steps on each falling edge of the pin, and a high DIR pin means closing.
+void plant_sim_pulse() {
+    int pul = gpio_emul_output_get(pul_gpio.port, pul_gpio.pin);
+    if (last_pul && !pul) {
+        float step = gpio_emul_output_get(dir_gpio.port, dir_gpio.pin) ? -DEG_PER_STEP : DEG_PER_STEP;
+        valve_deg = std::clamp(valve_deg + step, MIN_DEG, MAX_DEG);
+    }
+    last_pul = pul;
+}
+
+/// Whether the valve is against its open-side hard stop.
+bool plant_sim_endstop_triggered() {
+    return valve_deg >= MAX_DEG;
+}
+
+float plant_sim_get_valve_deg() {
+    return valve_deg;
+}
+
+/// Steady-state pressures for a valve angle.
+static pt_readings steady_state(float deg) {
+    // Open area as a fraction of fully open. Roughly a ball valve's characteristic: little flow until well open.
+    float area = (deg - MIN_DEG) / (MAX_DEG - MIN_DEG);
+    area *= area;
+    if (area <= 0.0f) {
+        return pt_readings{
+                .pt102 = TANK_PSI,
+                .pt202 = TANK_PSI,
+                .pt203 = 0.0f,
+                .ptf401 = 0.0f,
+        };
+    }
+
+    // Solve K * mdot^2 + K_CHAMBER * mdot - TANK_PSI = 0 for the flow through the restrictions in series.
+    float k_valve = K_VALVE_OPEN / (area * area);
+    float k_total = K_LINE + k_valve + K_INJECTOR;
+    float mdot = (-K_CHAMBER + sqrtf(K_CHAMBER * K_CHAMBER + 4.0f * k_total * TANK_PSI)) / (2.0f * k_total);
+    float mdot_sq = mdot * mdot;
+
+    float valve_in = TANK_PSI - K_LINE * mdot_sq;
+    float valve_out = valve_in - k_valve * mdot_sq;
+    return pt_readings{
+            .pt102 = TANK_PSI,
+            .pt202 = valve_in,
+            .pt203 = valve_out,
+            .ptf401 = K_CHAMBER * mdot,
+    };
+}
+
+static uint32_t psi_to_mv(float psi) {
+    float mv = psi / PT_FULL_SCALE_PSI * PT_FULL_SCALE_MV;
+    return static_cast<uint32_t>(std::clamp(mv, 0.0f, PT_FULL_SCALE_MV));
+}
+
+/// Advances the feed system by one tick and updates the emulated PT voltages.
+static void plant_tick(k_timer *) {
+    pt_readings target = steady_state(valve_deg);
+    constexpr float ALPHA = TICK_S / (TIME_CONSTANT_S + TICK_S);
+#define CLOVER_PLANT_SIM_SETTLE(node_id, prop, idx)                                                          \
+    pressures.DT_STRING_TOKEN_BY_IDX(node_id, prop, idx) +=                                              \
+            ALPHA * (target.DT_STRING_TOKEN_BY_IDX(node_id, prop, idx) -                                 \
+                     pressures.DT_STRING_TOKEN_BY_IDX(node_id, prop, idx));                              \
+    adc_emul_const_value_set(DEVICE_DT_GET(DT_IO_CHANNELS_CTLR_BY_IDX(node_id, idx)),                    \
+                             DT_IO_CHANNELS_INPUT_BY_IDX(node_id, idx),                                  \
+                             psi_to_mv(pressures.DT_STRING_TOKEN_BY_IDX(node_id, prop, idx)));
+    DT_FOREACH_PROP_ELEM(USER_NODE, pt_names, CLOVER_PLANT_SIM_SETTLE)
+#undef CLOVER_PLANT_SIM_SETTLE
+}
+
+K_TIMER_DEFINE(plant_tick_timer, plant_tick, nullptr);
+
+static int plant_sim_init() {
+    pressures = steady_state(valve_deg);
+    k_timer_start(&plant_tick_timer, K_NO_WAIT, K_USEC(USEC_PER_SEC / TICK_HZ));
+    LOG_INF("Plant simulator running, valve at %d deg", CONFIG_GNC_PLANT_SIM_INITIAL_DEG);
+    return 0;
+}
+
+SYS_INIT(plant_sim_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
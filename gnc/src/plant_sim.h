@@ -0,0 +1,10 @@
+#ifndef CLOVER_PLANT_SIM_H
+#define CLOVER_PLANT_SIM_H
+
+void plant_sim_pulse();
+
+bool plant_sim_endstop_triggered();
+
+float plant_sim_get_valve_deg();
+
+#endif //CLOVER_PLANT_SIM_H
@@ -0,0 +1,156 @@
+#include "pressure_control.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "persist.h"
+
+LOG_MODULE_REGISTER(pressure_control, CONFIG_LOG_DEFAULT_LEVEL);
+
+/*
+ * Closed-loop chamber pressure control. Each control tick turns a pressure target and the latest chamber reading into
+ * a valve angle:
+ *
+ *     deg = feedforward(target) + kp * error + integral(ki * error) - kd * d(filtered)/dt
+ *
+ * The feedforward comes from the valve characteristic, the angle at which the chamber settles at each pressure, so
+ * the PID only has to correct what the table gets wrong. The reading is low-pass filtered first, and the derivative
+ * acts on the filtered reading rather than the error, so steps in the target don't kick the valve. While the valve
+ * can't keep up with the command, whether it's slewing as fast as it can or pinned against either end of its travel,
+ * the integral stops growing in that direction, so it doesn't wind up and overshoot once the valve catches up.
+ *
+ * Everything here is a handful of float operations and a short table walk, well inside a control tick.
+ */
+
+constexpr float MIN_DEG = 0.0f;
+constexpr float MAX_DEG = 90.0f;
+constexpr float TICK_S = 0.001f;
+constexpr float FILTER_TIME_CONSTANT_S = CONFIG_GNC_PRESSURE_CONTROL_FILTER_MS / 1000.0f;
+/// Weight of each new reading in the filter. 1 with the filter off.
+constexpr float FILTER_ALPHA = TICK_S / (FILTER_TIME_CONSTANT_S + TICK_S);
+/// How far the command may run ahead of the valve before the valve counts as unable to keep up. A few ticks of travel
+/// at the valve's top speed.
+constexpr float LAG_DEG = 1.0f;
+
+/// Matches the feed system simulator at its default 600 psi tank. Real hardware needs its own, from a characterization
+/// run, uploaded with pctable#.
+static std::array<valve_characteristic_point, PRESSURE_CONTROL_MAX_CHARACTERISTIC_POINTS> characteristic = {{
+        {0.0f, 0.0f},
+        {22.7f, 10.0f},
+        {85.4f, 20.0f},
+        {171.2f, 30.0f},
+        {256.7f, 40.0f},
+        {323.7f, 50.0f},
+        {368.1f, 60.0f},
+        {394.9f, 70.0f},
+        {410.7f, 80.0f},
+        {420.0f, 90.0f},
+}};
+static int characteristic_len = 10;
+
+/// Guards the characteristic against changes while a sequence is using it.
+K_MUTEX_DEFINE(characteristic_lock);
+static bool active = false;
+
+static pressure_gains gains;
+static float filtered_psi = 0.0f;
+static float integral_deg = 0.0f;
+
+bool pressure_gains_valid(const pressure_gains &g) {
+    return std::isfinite(g.kp) && std::isfinite(g.ki) && std::isfinite(g.kd) && g.kp >= 0.0f && g.ki >= 0.0f &&
+           g.kd >= 0.0f;
+}
+
+/// Replaces the valve characteristic. Points must rise in both pressure and angle, within the valve's travel. Refused
+/// while a sequence is under pressure control. Returns 0, or 1 if the table is invalid or in use.
+int pressure_control_set_characteristic(std::span<const valve_characteristic_point> points) {
+    if (points.size() < 2 || std::ssize(points) > PRESSURE_CONTROL_MAX_CHARACTERISTIC_POINTS) {
+        LOG_ERR("Valve characteristic needs 2 to %d points", PRESSURE_CONTROL_MAX_CHARACTERISTIC_POINTS);
+        return 1;
+    }
+    for (int i = 0; i < std::ssize(points); ++i) {
+        const valve_characteristic_point &point = points[i];
+        bool in_range = std::isfinite(point.chamber_psi) && point.valve_deg >= MIN_DEG && point.valve_deg <= MAX_DEG;
+        bool rising = i == 0 ||
+                      (point.chamber_psi > points[i - 1].chamber_psi && point.valve_deg > points[i - 1].valve_deg);
+        if (!in_range || !rising) {
+            LOG_ERR("Invalid valve characteristic point %d: %f psi, %f deg", i, static_cast<double>(point.chamber_psi),
+                    static_cast<double>(point.valve_deg));
+            return 1;
+        }
+    }
+
+    k_mutex_lock(&characteristic_lock, K_FOREVER);
+    if (active) {
+        k_mutex_unlock(&characteristic_lock);
+        LOG_ERR("Can't change the valve characteristic during a sequence");
+        return 1;
+    }
+    std::copy(points.begin(), points.end(), characteristic.begin());
+    characteristic_len = static_cast<int>(points.size());
+    k_mutex_unlock(&characteristic_lock);
+    persist_save_later();
+    return 0;
+}
+
+std::span<const valve_characteristic_point> pressure_control_get_characteristic() {
+    return {characteristic.data(), static_cast<size_t>(characteristic_len)};
+}
+
+/// Valve angle expected to hold the chamber at target_psi, interpolated from the characteristic. Targets beyond the
+/// table get its end angles.
+float pressure_control_feedforward(float target_psi) {
+    if (target_psi <= characteristic[0].chamber_psi) {
+        return characteristic[0].valve_deg;
+    }
+    for (int i = 1; i < characteristic_len; ++i) {
+        const valve_characteristic_point &to = characteristic[i];
+        if (target_psi < to.chamber_psi) {
+            const valve_characteristic_point &from = characteristic[i - 1];
+            float tween = (target_psi - from.chamber_psi) / (to.chamber_psi - from.chamber_psi);
+            return from.valve_deg + (to.valve_deg - from.valve_deg) * tween;
+        }
+    }
+    return characteristic[characteristic_len - 1].valve_deg;
+}
+
+/// Starts controlling with the given gains, from a chamber currently at measured_psi. The characteristic is locked
+/// until pressure_control_end.
+void pressure_control_begin(const pressure_gains &new_gains, float measured_psi) {
+    k_mutex_lock(&characteristic_lock, K_FOREVER);
+    active = true;
+    k_mutex_unlock(&characteristic_lock);
+    gains = new_gains;
+    filtered_psi = measured_psi;
+    integral_deg = 0.0f;
+}
+
+/// Runs one control tick, given the valve's current angle. Returns the valve angle to move to.
+float pressure_control_step(float target_psi, float measured_psi, float valve_deg) {
+    float last_psi = filtered_psi;
+    filtered_psi += FILTER_ALPHA * (measured_psi - filtered_psi);
+
+    float error = target_psi - filtered_psi;
+    float derivative = -gains.kd * (filtered_psi - last_psi) / TICK_S;
+    float integral = integral_deg + gains.ki * error * TICK_S;
+    float command = pressure_control_feedforward(target_psi) + gains.kp * error + integral + derivative;
+
+    // Only let the integral grow while the valve can still act on it.
+    float reachable = std::clamp(command, MIN_DEG, MAX_DEG);
+    bool held_open = error > 0.0f && (command > MAX_DEG || reachable - valve_deg > LAG_DEG);
+    bool held_closed = error < 0.0f && (command < MIN_DEG || reachable - valve_deg < -LAG_DEG);
+    if (!held_open && !held_closed) {
+        integral_deg = integral;
+    }
+    return reachable;
+}
+
+/// Releases the characteristic at the end of a sequence.
+void pressure_control_end() {
+    k_mutex_lock(&characteristic_lock, K_FOREVER);
+    active = false;
+    k_mutex_unlock(&characteristic_lock);
+}
@@ -0,0 +1,39 @@
+#ifndef CLOVER_PRESSURE_CONTROL_H
+#define CLOVER_PRESSURE_CONTROL_H
+
+#include <span>
+
+/// Most points the valve characteristic may have.
+constexpr int PRESSURE_CONTROL_MAX_CHARACTERISTIC_POINTS = 16;
+
+/// PID gains for chamber pressure control, whose output is a valve angle.
+struct pressure_gains {
+    /// deg per psi of error.
+    float kp;
+    /// deg per psi of error, per second.
+    float ki;
+    /// deg per psi/s of change in the measured pressure.
+    float kd;
+};
+
+/// One point of the valve characteristic: the angle at which the chamber settles at chamber_psi.
+struct valve_characteristic_point {
+    float chamber_psi;
+    float valve_deg;
+};
+
+bool pressure_gains_valid(const pressure_gains &gains);
+
+int pressure_control_set_characteristic(std::span<const valve_characteristic_point> points);
+
+std::span<const valve_characteristic_point> pressure_control_get_characteristic();
+
+float pressure_control_feedforward(float target_psi);
+
+void pressure_control_begin(const pressure_gains &gains, float measured_psi);
+
+float pressure_control_step(float target_psi, float measured_psi, float valve_deg);
+
+void pressure_control_end();
+
+#endif //CLOVER_PRESSURE_CONTROL_H
@@ -5,6 +5,13 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/kernel.h>
 #include <array>
+#include <cmath>
+#include <cstring>
+
+#include "gnc_trace.h"
+#include "log_limit.h"
+#include "persist.h"
+#include "redline.h"
 
 #define USER_NODE DT_PATH(zephyr_user)
 
@@ -21,8 +28,12 @@
 #error "pts: `pt-names` and `io-channels` must have the same length."
 #endif
 
-#define CONFIG_PT_SAMPLES 1
-
+/*
+ * The ADC converts every PT continuously, a frame of all of them each CONFIG_GNC_PTS_INTERVAL_US, rather than once per
+ * control tick. The driver calls on_frame as each frame completes, usually from its ISR, which keeps a copy for
+ * pts_sample and checks it against the redlines, then has the driver convert the next frame into the same buffer.
+ * Control ticks and commands read the latest frame without waiting on a conversion.
+ */
 
 // Trailing comma needed as we are using preprocessor to instantiate each element of an array.
 #define CLOVER_PTS_DT_SPEC_AND_COMMA(node_id, prop, idx) ADC_DT_SPEC_GET_BY_IDX(node_id, idx),
@@ -30,15 +41,39 @@ static constexpr struct adc_dt_spec adc_channels[NUM_PTS] = {
         DT_FOREACH_PROP_ELEM(USER_NODE, io_channels, CLOVER_PTS_DT_SPEC_AND_COMMA)
 };
 
+static adc_action on_frame(const device *, const adc_sequence *, uint16_t);
+
 static adc_sequence_options sequence_options = {
-        .interval_us = 0,
-        .extra_samplings = CONFIG_PT_SAMPLES - 1,
+        .interval_us = CONFIG_GNC_PTS_INTERVAL_US,
+        .callback = on_frame,
+        .user_data = nullptr,
+        .extra_samplings = 0,
 };
 static adc_sequence sequence;
-uint16_t raw_readings[CONFIG_PT_SAMPLES][NUM_PTS];
+/// Frame being converted. Only on_frame may read it.
+static uint16_t raw_readings[NUM_PTS];
+/// Latest complete frame, copied out of raw_readings with interrupts masked so it is never read half-written.
+static uint16_t latest_frame[NUM_PTS];
+static volatile uint32_t frames = 0;
+/// Raised if acquisition stops, with the driver's error.
+static k_poll_signal acquisition_stopped = K_POLL_SIGNAL_INITIALIZER(acquisition_stopped);
+#ifdef CONFIG_ZTEST
+/// Whether acquisition stops at every frame, as if the ADC had died.
+static volatile bool acquisition_failing = false;
+#endif
 
 LOG_MODULE_REGISTER(pts, CONFIG_LOG_DEFAULT_LEVEL);
 
+/// Shortest time between repeats of a sampling error. PTs are read every control tick.
+constexpr uint32_t LOG_INTERVAL_MS = 1000;
+/// Longest wait for the first frame after starting acquisition.
+constexpr int FIRST_FRAME_TIMEOUT_MS = 100;
+
+static constexpr const char *PT_NAMES[] = {
+        DT_FOREACH_PROP_ELEM_SEP(USER_NODE, pt_names, DT_PROP_BY_IDX, (,))
+};
+static_assert(std::size(PT_NAMES) == NUM_PTS);
+
 constexpr std::array<float, NUM_PTS> pts_adc_ranges() {
     std::array<float, NUM_PTS> ranges;
     for (int i = 0; i < NUM_PTS; ++i) {
@@ -70,7 +105,47 @@ pt_config pt_configs[NUM_PTS] = {
         },
 };
 
-/// Initialize PT sensors by initializing the ADC they're all connected to.
+/// Keeps each converted frame and checks it against the redlines, then carries on with the next.
+static adc_action on_frame(const device *, const adc_sequence *, uint16_t) {
+#ifdef CONFIG_ZTEST
+    if (acquisition_failing) {
+        return ADC_ACTION_FINISH;
+    }
+#endif
+    unsigned int key = irq_lock();
+    memcpy(latest_frame, raw_readings, sizeof(latest_frame));
+    frames += 1;
+    irq_unlock(key);
+    redline_check(raw_readings);
+    return ADC_ACTION_REPEAT;
+}
+
+/// Starts continuous acquisition. It runs until the driver reports an error.
+static int start_acquisition() {
+    k_poll_signal_reset(&acquisition_stopped);
+    gnc_trace(gnc_trace_event::ADC_START, 0);
+    return adc_read_async(adc_channels[0].dev, &sequence, &acquisition_stopped);
+}
+
+/// Restarts acquisition if it stopped. Runs in the system workqueue, so only one restart is ever attempted at a time.
+static void restart_acquisition(k_work *) {
+    unsigned int stopped;
+    int result;
+    k_poll_signal_check(&acquisition_stopped, &stopped, &result);
+    if (!stopped) {
+        return;
+    }
+    gnc_trace(gnc_trace_event::ADC_DONE, result);
+    LOG_ERR_LIMITED(LOG_INTERVAL_MS, "ADC acquisition stopped: err %d", result);
+    int err = start_acquisition();
+    if (err) {
+        LOG_ERR_LIMITED(LOG_INTERVAL_MS, "Failed to restart ADC acquisition: err %d", err);
+    }
+}
+
+K_WORK_DEFINE(restart_work, restart_acquisition);
+
+/// Initialize PT sensors by initializing the ADC they're all connected to, and start sampling them.
 int pts_init() {
     // Initializes resolution and oversampling from device tree. Let's assume all channels share those properties. Also
     // initializes `channels` with just one channel, so we overwrite that later to sample all channels at once.
@@ -99,6 +174,21 @@ int pts_init() {
         sequence.channels |= BIT(adc_channels[i].channel_id);
     }
 
+    LOG_INF("Starting acquisition every %d us", CONFIG_GNC_PTS_INTERVAL_US);
+    int err = start_acquisition();
+    if (err) {
+        LOG_ERR("Failed to start ADC acquisition: err %d", err);
+        return 1;
+    }
+    // So readings are real from the first pts_sample.
+    for (int i = 0; frames == 0; ++i) {
+        if (i == FIRST_FRAME_TIMEOUT_MS) {
+            LOG_ERR("No PT readings within %d ms", FIRST_FRAME_TIMEOUT_MS);
+            return 1;
+        }
+        k_msleep(1);
+    }
+
     return 0;
 }
 
@@ -106,28 +196,36 @@ int pts_init() {
 //
 //}
 
-/// Update PT sample readings.
-pt_readings pts_sample() {
-    int err = adc_read(adc_channels[0].dev, &sequence);
-    if (err) {
-        LOG_ERR("Failed to read from ADC: err %d", err);
-        return pt_readings{};
+/// Latest PT readings. Never waits on the ADC. Returns nonzero, with every reading NaN, if acquisition has stopped.
+int pts_sample(pt_readings &readings) {
+    unsigned int stopped;
+    int result;
+    k_poll_signal_check(&acquisition_stopped, &stopped, &result);
+    if (stopped) {
+        k_work_submit(&restart_work);
+#define CLOVER_PTS_DT_TO_NAN_ASSIGNMENT(node_id, prop, idx) .DT_STRING_TOKEN_BY_IDX(node_id, prop, idx) = NAN,
+        readings = pt_readings{
+                DT_FOREACH_PROP_ELEM(USER_NODE, pt_names, CLOVER_PTS_DT_TO_NAN_ASSIGNMENT)
+        };
+        return 1;
     }
 
-    // Averaging readings
-    float readings_by_idx[NUM_PTS] = {0};
+    uint16_t frame[NUM_PTS];
+    unsigned int key = irq_lock();
+    memcpy(frame, latest_frame, sizeof(frame));
+    irq_unlock(key);
+
+    float readings_by_idx[NUM_PTS];
     for (int i = 0; i < NUM_PTS; ++i) {
-        for (int j = 0; j < CONFIG_PT_SAMPLES; ++j) {
-            readings_by_idx[i] += static_cast<float>(raw_readings[j][i]);
-        }
-        readings_by_idx[i] = readings_by_idx[i] / CONFIG_PT_SAMPLES * pt_configs[i].scale + pt_configs[i].bias;
+        readings_by_idx[i] = static_cast<float>(frame[i]) * pt_configs[i].scale + pt_configs[i].bias;
     }
 
     // Assign each PT name as fields to initialize pt_readings
 #define CLOVER_PTS_DT_TO_READINGS_ASSIGNMENT(node_id, prop, idx) .DT_STRING_TOKEN_BY_IDX(node_id, prop, idx) = readings_by_idx[idx],
-    return pt_readings{
+    readings = pt_readings{
             DT_FOREACH_PROP_ELEM(USER_NODE, pt_names, CLOVER_PTS_DT_TO_READINGS_ASSIGNMENT)
     };
+    return 0;
 }
 
 /// Log PT readings for debug purposes
@@ -136,6 +234,16 @@ void pts_log_readings(const pt_readings &readings) {
     DT_FOREACH_PROP_ELEM(USER_NODE, pt_names, CLOVER_PTS_DT_TO_LOG)
 }
 
+/// Frames converted since boot.
+uint32_t pts_frame_count() {
+    return frames;
+}
+
+/// Name of the PT at index, as in the devicetree.
+const char *pts_name(int index) {
+    return PT_NAMES[index];
+}
+
 int pts_set_bias(int index, float bias) {
     if (index < 0 || index >= NUM_PTS) {
         LOG_ERR("Invalid PT index: %d", index);
@@ -143,6 +251,7 @@ int pts_set_bias(int index, float bias) {
     }
 
     pt_configs[index].bias = bias;
+    persist_save_later();
 
     return 0;
 }
@@ -155,6 +264,15 @@ int pts_set_range(int index, float range) {
 
     pt_configs[index].range = range;
     pt_configs[index].scale = range / pts_adc_ranges()[index];
+    persist_save_later();
 
     return 0;
 }
+
+#ifdef CONFIG_ZTEST
+/// Makes acquisition stop at the next frame, and at the first frame of every restart, until cleared, so tests can see
+/// what a dead ADC does. Once cleared, the next pts_sample restarts it.
+void pts_fail_acquisition(bool fail) {
+    acquisition_failing = fail;
+}
+#endif
@@ -2,6 +2,7 @@
 #define CLOVER_PTS_H
 
 #include <zephyr/devicetree.h>
+#include <cstdint>
 
 /*
  * The following macro magic is used to generate a struct to hold the result of one PT reading. If the device tree has:
@@ -36,7 +37,11 @@ extern pt_config pt_configs[NUM_PTS];
 
 int pts_init();
 
-pt_readings pts_sample();
+int pts_sample(pt_readings &readings);
+
+uint32_t pts_frame_count();
+
+const char *pts_name(int index);
 
 void pts_log_readings(const pt_readings &readings);
 
@@ -44,4 +49,8 @@ int pts_set_bias(int index, float bias);
 
 int pts_set_range(int index, float range);
 
+#ifdef CONFIG_ZTEST
+void pts_fail_acquisition(bool fail);
+#endif
+
 #endif //CLOVER_PTS_H
@@ -0,0 +1,325 @@
+#include "redline.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "persist.h"
+#include "throttle_valve.h"
+
+LOG_MODULE_REGISTER(redline, CONFIG_LOG_DEFAULT_LEVEL);
+
+/*
+ * Checks every PT frame against its limits while a sequence runs, and aborts to a safe valve position once any limit is
+ * exceeded for CONFIG_GNC_REDLINE_CONFIRM_FRAMES frames in a row, so one noisy frame doesn't end a test.
+ *
+ * redline_check runs as each frame is converted, usually in the ADC's ISR, so arming converts the limits to raw ADC
+ * counts and valve microsteps, and the check is a few integer compares per PT. A trip hands the abort to the system
+ * workqueue, which runs the control ticks, so the safe position is commanded as soon as any tick in progress finishes
+ * rather than in the middle of one. From the first frame over a limit to the command is then at most
+ * CONFIG_GNC_REDLINE_CONFIRM_FRAMES frames plus one control tick.
+ *
+ * A stopped or stalled ADC delivers no frames, so nothing above would ever run. Control ticks check that frames are
+ * still arriving, and CONFIG_GNC_REDLINE_STALE_TICKS ticks in a row without one is a trip of its own.
+ */
+
+/// Rates are measured across about a millisecond of frames, so ADC noise between neighbouring frames isn't a rate.
+constexpr int RATE_WINDOW_FRAMES = MAX(1, 1000 / CONFIG_GNC_PTS_INTERVAL_US);
+constexpr float RATE_WINDOW_S = static_cast<float>(RATE_WINDOW_FRAMES * CONFIG_GNC_PTS_INTERVAL_US) / 1e6f;
+
+static pt_redline pt_limits[NUM_PTS] = {};
+static valve_redline valve_limits = {.max_tracking_deg = 0.0f, .safe_deg = 0.0f};
+
+/// A PT's limits in raw ADC counts, and the calibration they were converted with.
+struct raw_limits {
+    int32_t min;
+    int32_t max;
+    /// Largest change across RATE_WINDOW_FRAMES.
+    int32_t max_delta;
+    float scale;
+    float bias;
+};
+
+/// Limits as of the last redline_arm. The check reads only these, so changes wait for the next sequence.
+static raw_limits armed_limits[NUM_PTS];
+static int32_t armed_max_tracking_steps = INT32_MAX;
+static float armed_safe_deg = 0.0f;
+
+/// The last RATE_WINDOW_FRAMES frames, the oldest at history_next once frames_seen reaches RATE_WINDOW_FRAMES.
+static uint16_t history[RATE_WINDOW_FRAMES][NUM_PTS];
+static int history_next = 0;
+static int frames_seen = 0;
+
+/// Consecutive frames over each limit.
+static uint8_t level_frames[NUM_PTS];
+static uint8_t rate_frames[NUM_PTS];
+static uint8_t tracking_frames = 0;
+/// Frame count as of the last control tick, and consecutive ticks it hasn't moved.
+static uint32_t last_frame_count = 0;
+static uint32_t stale_ticks = 0;
+
+static volatile bool armed = false;
+static volatile bool tripped = false;
+static volatile bool aborted = false;
+
+/// What tripped, in the check's units: raw counts, a raw change, or microsteps from the command.
+static redline_limit trip_limit = redline_limit::NONE;
+static int trip_pt = -1;
+static int32_t trip_raw = 0;
+static uint32_t trip_cycles = 0;
+static uint32_t abort_cycles = 0;
+
+/// Commands the safe position. Control ticks keep commanding it until the sequence ends.
+static void abort_to_safe(k_work *) {
+    // The sequence may have ended since the trip, and a valve set moving with no ticks to follow would never stop.
+    if (!armed) {
+        return;
+    }
+    throttle_valve_move(armed_safe_deg);
+    abort_cycles = k_cycle_get_32();
+    aborted = true;
+
+    redline_trip trip = redline_last_trip();
+    LOG_ERR("Redline %s on %s at %f, valve to %f deg after %u us", redline_limit_name(trip.limit),
+            redline_trip_source(trip), static_cast<double>(trip.value), static_cast<double>(armed_safe_deg),
+            trip.latency_us);
+}
+
+K_WORK_DEFINE(abort_work, abort_to_safe);
+
+/// Latches the first trip and hands the abort to the workqueue. Called from the check.
+static void trip(redline_limit limit, int pt, int32_t raw_value) {
+    trip_cycles = k_cycle_get_32();
+    trip_limit = limit;
+    trip_pt = pt;
+    trip_raw = raw_value;
+    tripped = true;
+    k_work_submit(&abort_work);
+}
+
+/// Counts one more frame over a limit, or resets the count, and returns whether that confirms a trip.
+static bool confirm(uint8_t &count, bool over) {
+    if (!over) {
+        count = 0;
+        return false;
+    }
+    count += 1;
+    return count >= CONFIG_GNC_REDLINE_CONFIRM_FRAMES;
+}
+
+/// Checks a frame of raw readings, in the ADC's channel order, against the armed limits. Does nothing unless armed.
+/// Runs at the full acquisition rate, usually in an ISR.
+void redline_check(const uint16_t raw[NUM_PTS]) {
+    if (!armed || tripped) {
+        return;
+    }
+
+    const uint16_t *window_start = frames_seen == RATE_WINDOW_FRAMES ? history[history_next] : raw;
+    for (int i = 0; i < NUM_PTS; ++i) {
+        const raw_limits &limits = armed_limits[i];
+        int32_t reading = raw[i];
+        if (confirm(level_frames[i], reading < limits.min || reading > limits.max)) {
+            trip(reading < limits.min ? redline_limit::LOW : redline_limit::HIGH, i, reading);
+            return;
+        }
+        int32_t delta = reading - window_start[i];
+        if (confirm(rate_frames[i], delta > limits.max_delta || delta < -limits.max_delta)) {
+            trip(redline_limit::RATE, i, delta);
+            return;
+        }
+    }
+    memcpy(history[history_next], raw, sizeof(history[0]));
+    history_next = (history_next + 1) % RATE_WINDOW_FRAMES;
+    frames_seen = MIN(frames_seen + 1, RATE_WINDOW_FRAMES);
+
+    int32_t error = throttle_valve_get_target_steps() - throttle_valve_get_steps();
+    if (confirm(tracking_frames, error > armed_max_tracking_steps || error < -armed_max_tracking_steps)) {
+        trip(redline_limit::TRACKING, -1, error);
+    }
+}
+
+/// Checks that PT frames are still arriving. Does nothing unless armed. Called once per control tick.
+void redline_check_acquisition() {
+    uint32_t frame_count = pts_frame_count();
+    // Frames are checked in an ISR, which could trip at the same time.
+    unsigned int key = irq_lock();
+    if (armed && !tripped) {
+        stale_ticks = frame_count == last_frame_count ? stale_ticks + 1 : 0;
+        last_frame_count = frame_count;
+        if (stale_ticks >= CONFIG_GNC_REDLINE_STALE_TICKS) {
+            trip(redline_limit::ACQUISITION, -1, static_cast<int32_t>(stale_ticks));
+        }
+    }
+    irq_unlock(key);
+}
+
+/// Rounds counts to an int32_t, saturating rather than overflowing.
+static int32_t saturate(double counts) {
+    return static_cast<int32_t>(std::clamp<double>(counts, INT32_MIN, INT32_MAX));
+}
+
+/// Converts a PT's limits to raw counts under its current calibration.
+static raw_limits to_raw(int index) {
+    const pt_redline &limits = pt_limits[index];
+    const pt_config &config = pt_configs[index];
+    raw_limits converted = {
+            .min = INT32_MIN,
+            .max = INT32_MAX,
+            .max_delta = INT32_MAX,
+            .scale = config.scale,
+            .bias = config.bias,
+    };
+    if (!limits.enabled) {
+        return converted;
+    }
+    if (!(config.scale > 0.0f)) {
+        LOG_WRN("Not checking %s, its range is invalid", pts_name(index));
+        return converted;
+    }
+    converted.min = saturate(std::ceil((limits.min_psi - config.bias) / config.scale));
+    converted.max = saturate(std::floor((limits.max_psi - config.bias) / config.scale));
+    if (limits.max_rate_psi_per_s > 0.0f) {
+        converted.max_delta = saturate(std::floor(limits.max_rate_psi_per_s * RATE_WINDOW_S / config.scale));
+    }
+    return converted;
+}
+
+/// Starts checking frames against the limits as they are now, under the PTs' current calibration. Clears the last
+/// trip.
+void redline_arm() {
+    raw_limits converted[NUM_PTS];
+    for (int i = 0; i < NUM_PTS; ++i) {
+        converted[i] = to_raw(i);
+    }
+    int32_t max_tracking_steps = valve_limits.max_tracking_deg > 0.0f
+                                         ? throttle_valve_deg_to_steps(valve_limits.max_tracking_deg)
+                                         : INT32_MAX;
+
+    unsigned int key = irq_lock();
+    memcpy(armed_limits, converted, sizeof(armed_limits));
+    armed_max_tracking_steps = max_tracking_steps;
+    armed_safe_deg = valve_limits.safe_deg;
+    history_next = 0;
+    frames_seen = 0;
+    memset(level_frames, 0, sizeof(level_frames));
+    memset(rate_frames, 0, sizeof(rate_frames));
+    tracking_frames = 0;
+    last_frame_count = pts_frame_count();
+    stale_ticks = 0;
+    trip_limit = redline_limit::NONE;
+    tripped = false;
+    aborted = false;
+    armed = true;
+    irq_unlock(key);
+}
+
+/// Stops checking. The last trip is kept for redline_last_trip.
+void redline_disarm() {
+    armed = false;
+}
+
+/// Whether a limit has tripped since the last redline_arm.
+bool redline_tripped() {
+    return tripped;
+}
+
+/// Where the valve goes on a trip, as of the last redline_arm.
+float redline_get_safe_deg() {
+    return armed_safe_deg;
+}
+
+/// The trip since the last redline_arm, with limit NONE if there was none. latency_us is 0 until the safe position has
+/// been commanded.
+redline_trip redline_last_trip() {
+    redline_trip trip = {
+            .limit = redline_limit::NONE,
+            .pt = -1,
+            .value = 0.0f,
+            .latency_us = 0,
+    };
+    if (!tripped) {
+        return trip;
+    }
+    trip.limit = trip_limit;
+    trip.pt = trip_pt;
+    auto raw_value = static_cast<float>(trip_raw);
+    if (trip_limit == redline_limit::TRACKING) {
+        // A whole turn is an exact number of microsteps.
+        trip.value = raw_value * 360.0f / static_cast<float>(throttle_valve_deg_to_steps(360.0f));
+    } else if (trip_limit == redline_limit::ACQUISITION) {
+        trip.value = raw_value;
+    } else if (trip_limit == redline_limit::RATE) {
+        trip.value = raw_value * armed_limits[trip_pt].scale / RATE_WINDOW_S;
+    } else {
+        trip.value = raw_value * armed_limits[trip_pt].scale + armed_limits[trip_pt].bias;
+    }
+    if (aborted) {
+        trip.latency_us = k_cyc_to_us_floor32(abort_cycles - trip_cycles);
+    }
+    return trip;
+}
+
+const char *redline_limit_name(redline_limit limit) {
+    switch (limit) {
+        case redline_limit::LOW:
+            return "low";
+        case redline_limit::HIGH:
+            return "high";
+        case redline_limit::RATE:
+            return "rate";
+        case redline_limit::TRACKING:
+            return "tracking";
+        case redline_limit::ACQUISITION:
+            return "acquisition";
+        default:
+            return "none";
+    }
+}
+
+/// What tripped: a PT's name, the valve, or the ADC.
+const char *redline_trip_source(const redline_trip &trip) {
+    if (trip.pt >= 0) {
+        return pts_name(trip.pt);
+    }
+    return trip.limit == redline_limit::ACQUISITION ? "ADC" : "valve";
+}
+
+/// Sets the limits on the PT at index. They apply from the next sequence.
+int redline_set_pt(int index, const pt_redline &limits) {
+    if (index < 0 || index >= NUM_PTS) {
+        LOG_ERR("Invalid PT index: %d", index);
+        return 1;
+    }
+    if (limits.enabled && (!std::isfinite(limits.min_psi) || !std::isfinite(limits.max_psi) ||
+                           limits.min_psi >= limits.max_psi || !std::isfinite(limits.max_rate_psi_per_s) ||
+                           limits.max_rate_psi_per_s < 0.0f)) {
+        LOG_ERR("Invalid redline for %s", pts_name(index));
+        return 1;
+    }
+    pt_limits[index] = limits;
+    persist_save_later();
+    return 0;
+}
+
+pt_redline redline_get_pt(int index) {
+    return pt_limits[index];
+}
+
+/// Sets the valve's tracking limit and safe position. They apply from the next sequence.
+int redline_set_valve(const valve_redline &limits) {
+    if (!std::isfinite(limits.max_tracking_deg) || limits.max_tracking_deg < 0.0f || !std::isfinite(limits.safe_deg) ||
+        limits.safe_deg < 0.0f || limits.safe_deg > 90.0f) {
+        LOG_ERR("Invalid valve redline");
+        return 1;
+    }
+    valve_limits = limits;
+    persist_save_later();
+    return 0;
+}
+
+valve_redline redline_get_valve() {
+    return valve_limits;
+}
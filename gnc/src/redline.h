@@ -0,0 +1,79 @@
+#ifndef CLOVER_REDLINE_H
+#define CLOVER_REDLINE_H
+
+#include <cstdint>
+
+#include "pts.h"
+
+/// Limits on one PT's readings.
+struct pt_redline {
+    bool enabled;
+    /// Trips below this, in psi.
+    float min_psi;
+    /// Trips above this, in psi.
+    float max_psi;
+    /// Trips when the reading changes faster than this, in psi/s, measured over the last millisecond. 0 for no limit.
+    float max_rate_psi_per_s;
+};
+
+/// Limits on the valve, and where it goes when anything trips.
+struct valve_redline {
+    /// Trips when the valve is further than this from its commanded position, in deg. 0 for no limit.
+    float max_tracking_deg;
+    /// Angle the valve is driven to on a trip, in deg.
+    float safe_deg;
+};
+
+enum class redline_limit : uint8_t {
+    NONE,
+    /// A PT read below its min_psi.
+    LOW,
+    /// A PT read above its max_psi.
+    HIGH,
+    /// A PT changed faster than its max_rate_psi_per_s.
+    RATE,
+    /// The valve fell further behind its command than max_tracking_deg.
+    TRACKING,
+    /// PT frames stopped arriving, so no other limit could be checked.
+    ACQUISITION,
+};
+
+/// What tripped, for reporting once the abort is under way.
+struct redline_trip {
+    redline_limit limit;
+    /// PT that tripped, or -1 for the valve or the ADC.
+    int pt;
+    /// Reading that tripped: psi for LOW and HIGH, psi/s for RATE, deg from the command for TRACKING, and control
+    /// ticks without a new frame for ACQUISITION.
+    float value;
+    /// From the frame that confirmed the trip to the safe position being commanded, in us.
+    uint32_t latency_us;
+};
+
+int redline_set_pt(int index, const pt_redline &limits);
+
+pt_redline redline_get_pt(int index);
+
+int redline_set_valve(const valve_redline &limits);
+
+valve_redline redline_get_valve();
+
+void redline_arm();
+
+void redline_disarm();
+
+bool redline_tripped();
+
+float redline_get_safe_deg();
+
+redline_trip redline_last_trip();
+
+const char *redline_limit_name(redline_limit limit);
+
+const char *redline_trip_source(const redline_trip &trip);
+
+void redline_check(const uint16_t raw[NUM_PTS]);
+
+void redline_check_acquisition();
+
+#endif //CLOVER_REDLINE_H
@@ -0,0 +1,50 @@
+#include "reply_buffer.h"
+
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/cbprintf.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstring>
+
+#include "server.h"
+
+LOG_MODULE_REGISTER(reply_buffer, CONFIG_LOG_DEFAULT_LEVEL);
+
+/// Appends text verbatim, truncating if the buffer is full.
+void ReplyBuffer::append(std::string_view text) {
+    int n = std::min(static_cast<int>(text.size()), CAPACITY - len);
+    if (n < std::ssize(text)) {
+        LOG_WRN("Reply truncated, dropped %d bytes", static_cast<int>(std::ssize(text)) - n);
+    }
+    std::memcpy(buf + len, text.data(), n);
+    len += n;
+}
+
+/// Appends printf-style formatted text, truncating if the buffer is full.
+void ReplyBuffer::appendf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    // buf has one spare byte past CAPACITY for the null terminator vsnprintfcb always writes.
+    int would_write = vsnprintfcb(buf + len, CAPACITY - len + 1, fmt, args);
+    va_end(args);
+    if (would_write < 0) {
+        LOG_ERR("Failed to format reply: err %d", would_write);
+        return;
+    }
+    int written = std::min(would_write, CAPACITY - len);
+    if (written < would_write) {
+        LOG_WRN("Reply truncated, dropped %d bytes", would_write - written);
+    }
+    len += written;
+}
+
+/// Sends the buffered reply and clears the buffer.
+int ReplyBuffer::flush(int sock) {
+    int err = send_fully(sock, buf, len);
+    len = 0;
+    return err;
+}
+
+void ReplyBuffer::clear() {
+    len = 0;
+}
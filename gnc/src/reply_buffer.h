@@ -0,0 +1,31 @@
+#ifndef CLOVER_REPLY_BUFFER_H
+#define CLOVER_REPLY_BUFFER_H
+
+#include <zephyr/toolchain.h>
+#include <string_view>
+
+/// Fixed-capacity buffer that a response is formatted into before being sent, so replies never touch the heap.
+class ReplyBuffer {
+public:
+    static constexpr int CAPACITY = 512;
+
+    void append(std::string_view text);
+
+    void appendf(const char *fmt, ...) __printf_like(2, 3);
+
+    int flush(int sock);
+
+    /// Bytes that can still be appended without truncation.
+    [[nodiscard]] int available() const {
+        return CAPACITY - len;
+    }
+
+    void clear();
+
+private:
+    char buf[CAPACITY + 1];
+    int len = 0;
+};
+
+
+#endif //CLOVER_REPLY_BUFFER_H
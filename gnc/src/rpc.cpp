@@ -0,0 +1,312 @@
+#include "rpc.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/socket.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include <gnc/rpc_protocol.h>
+
+#include "server.h"
+#include "throttle_valve.h"
+#include "pts.h"
+#include "sequencer.h"
+
+LOG_MODULE_REGISTER(rpc, CONFIG_LOG_DEFAULT_LEVEL);
+
+/// Largest reply payload any request produces.
+constexpr int RPC_MAX_REPLY_PAYLOAD = 64;
+static_assert(sizeof(rpc_pt_configs_reply) <= RPC_MAX_REPLY_PAYLOAD);
+
+/// Reply under construction. Handlers write their payload into `payload` and set `length`.
+struct rpc_reply {
+    uint16_t length = 0;
+    uint8_t payload[RPC_MAX_REPLY_PAYLOAD];
+
+    template<typename T>
+    void set(const T &value) {
+        static_assert(sizeof(T) <= RPC_MAX_REPLY_PAYLOAD);
+        std::memcpy(payload, &value, sizeof(T));
+        length = sizeof(T);
+    }
+};
+
+/// Copies a fixed-size request payload out of the frame, checking its length.
+template<typename T>
+static bool read_payload(std::span<const uint8_t> payload, T &value) {
+    if (payload.size() != sizeof(T)) {
+        return false;
+    }
+    std::memcpy(&value, payload.data(), sizeof(T));
+    return true;
+}
+
+static rpc_status handle_ping(std::span<const uint8_t> payload, rpc_reply &reply) {
+    if (!payload.empty()) {
+        return rpc_status::BAD_LENGTH;
+    }
+    reply.set(rpc_ping_reply{
+            .device_time_ns = k_cyc_to_ns_floor64(k_cycle_get_64()),
+    });
+    return rpc_status::OK;
+}
+
+static rpc_status handle_get_pos(std::span<const uint8_t> payload, rpc_reply &reply) {
+    if (!payload.empty()) {
+        return rpc_status::BAD_LENGTH;
+    }
+    reply.set(rpc_pos_reply{
+            .pos_deg = throttle_valve_get_pos(),
+            .pos_steps = throttle_valve_get_steps(),
+    });
+    return rpc_status::OK;
+}
+
+static rpc_status handle_get_pts(std::span<const uint8_t> payload, rpc_reply &reply) {
+    if (!payload.empty()) {
+        return rpc_status::BAD_LENGTH;
+    }
+    pt_readings readings;
+    if (pts_sample(readings)) {
+        return rpc_status::FAILED;
+    }
+    reply.set(rpc_pts_reply{
+            .pt102 = readings.pt102,
+            .pt202 = readings.pt202,
+            .pt203 = readings.pt203,
+            .ptf401 = readings.ptf401,
+    });
+    return rpc_status::OK;
+}
+
+static rpc_status handle_set_pt_config(std::span<const uint8_t> payload, bool bias_not_range) {
+    rpc_pt_config_request request;
+    if (!read_payload(payload, request)) {
+        return rpc_status::BAD_LENGTH;
+    }
+    int index = static_cast<int>(request.pt);
+    if (index >= NUM_PTS || !std::isfinite(request.value)) {
+        return rpc_status::INVALID_ARGUMENT;
+    }
+    int err = bias_not_range ? pts_set_bias(index, request.value) : pts_set_range(index, request.value);
+    return err ? rpc_status::FAILED : rpc_status::OK;
+}
+
+static rpc_status handle_get_pt_configs(std::span<const uint8_t> payload, rpc_reply &reply) {
+    if (!payload.empty()) {
+        return rpc_status::BAD_LENGTH;
+    }
+    rpc_pt_configs_reply configs = {};
+    for (int i = 0; i < std::min(NUM_PTS, RPC_NUM_PTS); ++i) {
+        configs.pts[i].bias = pt_configs[i].bias;
+        configs.pts[i].range = pt_configs[i].range;
+    }
+    reply.set(configs);
+    return rpc_status::OK;
+}
+
+static rpc_status handle_prepare_seq(std::span<const uint8_t> payload, rpc_reply &reply) {
+    rpc_prepare_seq_request request;
+    if (payload.size() < sizeof(request) || (payload.size() - sizeof(request)) % sizeof(float) != 0) {
+        return rpc_status::BAD_LENGTH;
+    }
+    std::memcpy(&request, payload.data(), sizeof(request));
+    payload = payload.subspan(sizeof(request));
+
+    // As with the seq command, the valve's current position is the implicit first breakpoint.
+    std::array<float, SEQUENCER_MAX_BREAKPOINTS> breakpoints;
+    int num_breakpoints = 1 + static_cast<int>(payload.size() / sizeof(float));
+    // Bounding the gap keeps the sequence duration within an int.
+    if (num_breakpoints < 2 || num_breakpoints > SEQUENCER_MAX_BREAKPOINTS || request.gap_ms == 0 ||
+        request.gap_ms > INT32_MAX / SEQUENCER_MAX_BREAKPOINTS) {
+        return rpc_status::INVALID_ARGUMENT;
+    }
+    breakpoints[0] = throttle_valve_get_pos();
+    std::memcpy(&breakpoints[1], payload.data(), payload.size());
+    for (int i = 1; i < num_breakpoints; ++i) {
+        if (!std::isfinite(breakpoints[i])) {
+            return rpc_status::INVALID_ARGUMENT;
+        }
+    }
+
+    auto gap = static_cast<int>(request.gap_ms);
+    if (sequencer_prepare(gap, std::span<const float>{breakpoints.data(), static_cast<size_t>(num_breakpoints)})) {
+        return rpc_status::FAILED;
+    }
+    reply.set(rpc_prepare_seq_reply{
+            .duration_ms = static_cast<uint32_t>(sequencer_get_duration_ms()),
+    });
+    return rpc_status::OK;
+}
+
+static rpc_status handle_profile_begin(std::span<const uint8_t> payload) {
+    rpc_profile_begin_request request;
+    if (!read_payload(payload, request)) {
+        return rpc_status::BAD_LENGTH;
+    }
+    if (request.num_points < 1 || request.num_points > SEQUENCER_MAX_PROFILE_POINTS) {
+        return rpc_status::INVALID_ARGUMENT;
+    }
+    return sequencer_profile_begin(static_cast<int>(request.num_points)) ? rpc_status::FAILED : rpc_status::OK;
+}
+
+static rpc_status handle_profile_data(std::span<const uint8_t> payload) {
+    if (payload.size() % sizeof(rpc_profile_point) != 0) {
+        return rpc_status::BAD_LENGTH;
+    }
+    std::array<profile_point, RPC_MAX_PROFILE_POINTS_PER_FRAME> points;
+    size_t num_points = std::min(payload.size() / sizeof(rpc_profile_point), points.size());
+    for (size_t i = 0; i < num_points; ++i) {
+        rpc_profile_point point;
+        std::memcpy(&point, payload.data() + i * sizeof(point), sizeof(point));
+        points[i] = profile_point{
+                .duration_ms = point.duration_ms,
+                .target_deg = point.target_deg,
+        };
+    }
+    if (sequencer_profile_append(std::span<const profile_point>{points.data(), num_points})) {
+        return rpc_status::INVALID_ARGUMENT;
+    }
+    return rpc_status::OK;
+}
+
+static rpc_status handle_profile_end(std::span<const uint8_t> payload, rpc_reply &reply) {
+    if (!payload.empty()) {
+        return rpc_status::BAD_LENGTH;
+    }
+    if (sequencer_profile_end()) {
+        return rpc_status::FAILED;
+    }
+    reply.set(rpc_prepare_seq_reply{
+            .duration_ms = static_cast<uint32_t>(sequencer_get_duration_ms()),
+    });
+    return rpc_status::OK;
+}
+
+/// Runs a request with no payload in either direction.
+static rpc_status handle_action(std::span<const uint8_t> payload, int (*action)()) {
+    if (!payload.empty()) {
+        return rpc_status::BAD_LENGTH;
+    }
+    return action() ? rpc_status::FAILED : rpc_status::OK;
+}
+
+static rpc_status handle_request(const rpc_frame_header &header, std::span<const uint8_t> payload,
+                                 rpc_reply &reply) {
+    switch (header.type) {
+        case rpc_type::PING:
+            return handle_ping(payload, reply);
+        case rpc_type::GET_POS:
+            return handle_get_pos(payload, reply);
+        case rpc_type::GET_PTS:
+            return handle_get_pts(payload, reply);
+        case rpc_type::SET_PT_BIAS:
+            return handle_set_pt_config(payload, true);
+        case rpc_type::SET_PT_RANGE:
+            return handle_set_pt_config(payload, false);
+        case rpc_type::GET_PT_CONFIGS:
+            return handle_get_pt_configs(payload, reply);
+        case rpc_type::PREPARE_SEQ:
+            return handle_prepare_seq(payload, reply);
+        case rpc_type::START_SEQ:
+            return handle_action(payload, sequencer_start_trace);
+        case rpc_type::RESET_OPEN:
+            return handle_action(payload, throttle_valve_set_open);
+        case rpc_type::RESET_CLOSE:
+            return handle_action(payload, throttle_valve_set_closed);
+        case rpc_type::CALIBRATE:
+            return handle_action(payload, throttle_valve_start_calibrate);
+        case rpc_type::PROFILE_BEGIN:
+            return handle_profile_begin(payload);
+        case rpc_type::PROFILE_DATA:
+            return handle_profile_data(payload);
+        case rpc_type::PROFILE_END:
+            return handle_profile_end(payload, reply);
+    }
+    return rpc_status::UNKNOWN_TYPE;
+}
+
+static int send_reply(int sock, const rpc_frame_header &request, rpc_status status, rpc_reply &reply) {
+    rpc_frame_header header = {
+            .length = reply.length,
+            .type = request.type,
+            .request_id = request.request_id,
+            .status = status,
+    };
+    iovec iov[] = {
+            {.iov_base = &header, .iov_len = sizeof(header)},
+            {.iov_base = reply.payload, .iov_len = reply.length},
+    };
+    return send_iov_fully(sock, iov, reply.length > 0 ? 2 : 1);
+}
+
+/// Consumes the RPC_MAGIC that starts a binary connection, which may arrive over several reads. Returns 1 once all of
+/// it has been read and echoed back to confirm the switch, 0 if more is still to come, or a negative errno.
+int rpc_read_magic(client_context &ctx) {
+    uint8_t magic[sizeof(RPC_MAGIC)];
+    int remaining = static_cast<int>(sizeof(RPC_MAGIC)) - ctx.magic_read;
+    ssize_t bytes_read = zsock_recv(ctx.socket, magic, remaining, 0);
+    if (bytes_read < 0) {
+        LOG_WRN("Failed to read RPC magic: errno %d", errno);
+        return -errno;
+    }
+    if (bytes_read == 0) {
+        return -ECONNRESET;
+    }
+    if (std::memcmp(magic, RPC_MAGIC + ctx.magic_read, bytes_read) != 0) {
+        LOG_WRN("Client sent neither a text command nor RPC magic");
+        return -EPROTO;
+    }
+    ctx.magic_read += static_cast<int>(bytes_read);
+    if (ctx.magic_read < static_cast<int>(sizeof(RPC_MAGIC))) {
+        return 0;
+    }
+
+    int err = send_fully(ctx.socket, reinterpret_cast<const char *>(RPC_MAGIC), sizeof(RPC_MAGIC));
+    if (err) {
+        return err;
+    }
+    LOG_INF("Socket %d speaks binary RPC", ctx.socket);
+    return 1;
+}
+
+/// Reads once from a binary RPC connection and handles every complete request, in order. Returns 0 if the connection
+/// should stay open, or a negative errno.
+int rpc_service(client_context &ctx) {
+    int bytes_read = ctx.frames.fill(ctx.socket);
+    if (bytes_read < 0) {
+        LOG_WRN("Failed to read bytes: errno %d", -bytes_read);
+        return bytes_read;
+    }
+    if (bytes_read == 0) {
+        LOG_INF("Client closed connection");
+        return -ECONNRESET;
+    }
+
+    rpc_frame_header header;
+    std::span<const uint8_t> payload;
+    while (ctx.frames.next(header, payload)) {
+        rpc_reply reply;
+        if (header.length > RPC_MAX_PAYLOAD) {
+            // We can't find the next frame boundary without reading the oversized payload, so give up on the client.
+            LOG_WRN("RPC payload too large: %u bytes", header.length);
+            send_reply(ctx.socket, header, rpc_status::BAD_LENGTH, reply);
+            return -EMSGSIZE;
+        }
+        rpc_status status = handle_request(header, payload, reply);
+        if (status != rpc_status::OK) {
+            LOG_WRN("RPC request %u of type %u failed: status %d", header.request_id,
+                    static_cast<unsigned>(header.type), static_cast<int>(status));
+            reply.length = 0;
+        }
+        int err = send_reply(ctx.socket, header, status, reply);
+        if (err) {
+            LOG_ERR("Failed to send RPC reply: err %d", err);
+            return err;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef CLOVER_RPC_H
+#define CLOVER_RPC_H
+
+#include "commands.h"
+
+int rpc_read_magic(client_context &ctx);
+
+int rpc_service(client_context &ctx);
+
+#endif //CLOVER_RPC_H
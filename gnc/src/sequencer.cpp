@@ -1,108 +1,193 @@
 #include "sequencer.h"
 #include "throttle_valve.h"
 #include "pts.h"
-#include <vector>
 #include <zephyr/logging/log.h>
 #include <zephyr/kernel.h>
 #include <zephyr/sys/util.h>
-#include <zephyr/sys/cbprintf.h>
-#include <array>
-#include <zephyr/net/socket.h>
 #include <algorithm>
-#include <string>
+#include <array>
+#include <cmath>
 #include <cstdint>
-#include "server.h"
+#include "telemetry.h"
+#include "gnc_trace.h"
+#include "log_limit.h"
+#include "persist.h"
+#include "pressure_control.h"
+#include "redline.h"
 
 LOG_MODULE_REGISTER(sequencer, CONFIG_LOG_DEFAULT_LEVEL);
 
-constexpr uint64_t NSEC_PER_CONTROL_TICK = 1'000'000; // 1 ms
+/// Shortest time between repeats of an error in the control loop, which could otherwise log every tick.
+constexpr uint32_t LOG_INTERVAL_MS = 1000;
 
-static constexpr int MAX_BREAKPOINTS = 20;
+constexpr uint64_t NSEC_PER_CONTROL_TICK = 1'000'000; // 1 ms
+/// Longest a redline abort waits for the valve to reach its safe position before ending the sequence anyway. Full
+/// travel takes under half a second.
+constexpr int ABORT_TIMEOUT_MS = 1000;
 
 K_MUTEX_DEFINE(sequence_lock);
 
-static int gap_millis;
-static std::vector<float> breakpoints;
-static int data_sock = -1;
+/// A profile point, with its time as an offset from the start of the sequence, and the cubic that runs from it to the
+/// next point.
+struct timed_point {
+    uint32_t end_ms;
+    /// Valve angle in deg, or chamber pressure in psi under pressure control.
+    float target;
+    /// Coefficients of the cubic to the next point, in powers of ms since this one: at s ms past this point, the target
+    /// is target + s * (c1 + s * (c2 + s * c3)). Filled in by fit_profile.
+    float c1;
+    float c2;
+    float c3;
+};
+
+/// What a sequence's targets are, and so how the control loop gets from them to a valve angle.
+enum class control_mode {
+    /// Targets are valve angles, followed open-loop.
+    VALVE_ANGLE,
+    /// Targets are chamber pressures, which pressure_control turns into valve angles from the chamber PT each tick.
+    PRESSURE,
+};
+
+/// The prepared profile. The first point is replaced with the valve's position, or the chamber pressure, when the
+/// sequence starts. Uploads are refused while a sequence is running, so the control loop reads this without locking.
+static std::array<timed_point, SEQUENCER_MAX_PROFILE_POINTS + 1> profile;
+static int num_points = 0;
+/// Whether profile holds a complete profile, rather than nothing or an upload in progress.
+static bool profile_ready = false;
+/// Points still expected by the upload in progress.
+static int upload_remaining = 0;
+/// Index of the profile point the control loop is moving away from.
+static int segment = 0;
+/// How the prepared profile is followed. Preparing a new one resets this to VALVE_ANGLE.
+static control_mode mode = control_mode::VALVE_ANGLE;
+static pressure_gains gains = {};
+/// Whether a sequence or stream is in progress, from when it starts until the sender thread has sent the end marker.
+static bool running = false;
+/// Whether the thing in progress is a live stream rather than a sequence.
+static bool streaming = false;
+/// Cleared by the final control iteration so the sender thread knows no more data is coming.
+static volatile bool control_active = false;
+/// Iteration by which a redline abort gives up on reaching the safe position, or 0 if none is under way.
+static int abort_deadline = 0;
+/// Valve angle commanded by the last control iteration, in deg.
+static float command_deg = 0.0f;
 
 volatile int step_count = 0;
 volatile int count_to = 0;
 uint64_t start_clock = 0;
 
 
-/// Data that ought be logged for each control loop iteration.
-struct control_iter_data {
-    float time;
-    uint32_t queue_size;
-    float motor_target;
-    float motor_pos;
-    float motor_velocity;
-    float motor_acceleration;
-    uint64_t motor_nsec_per_pulse;
-    float pt202;
-    float pt203;
-    float ptf401;
-};
-
 /// Control loop iteration will enqueue data for broadcasting over ethernet by another thread.
-K_MSGQ_DEFINE(control_data_msgq, sizeof(control_iter_data), 100, 1);
+K_MSGQ_DEFINE(control_data_msgq, sizeof(telemetry_sample), 100, 1);
+
+/// Puts the valve and the given PT readings into a telemetry sample. target is the commanded valve angle, and
+/// pressure_target the chamber pressure setpoint it was commanded for, NaN if there is none.
+static telemetry_sample take_sample(float target, float pressure_target, const pt_readings &readings) {
+    uint64_t since_start = k_cycle_get_64() - start_clock;
+    uint64_t ns_since_start = k_cyc_to_ns_floor64(since_start);
+    return telemetry_sample{
+            .time = static_cast<float>(ns_since_start) / 1e9f,
+            .queue_size = k_msgq_num_used_get(&control_data_msgq),
+            .motor_target = target,
+            .motor_pos = throttle_valve_get_pos(),
+            .motor_velocity = throttle_valve_get_velocity(),
+            .motor_acceleration = throttle_valve_get_acceleration(),
+            .motor_nsec_per_pulse = throttle_valve_get_nsec_per_pulse(),
+            .pt202 = readings.pt202,
+            .pt203 = readings.pt203,
+            .ptf401 = readings.ptf401,
+            .pressure_target = pressure_target,
+    };
+}
+
+/// Runs a redline abort on past the end of the profile, until the valve reaches its safe position, then ends the
+/// sequence with the next iteration.
+static void end_abort_when_safe() {
+    if (abort_deadline == 0) {
+        abort_deadline = step_count + ABORT_TIMEOUT_MS;
+        count_to = INT32_MAX - 1;
+    }
+    if (throttle_valve_get_steps() == throttle_valve_get_target_steps()) {
+        count_to = step_count;
+    } else if (step_count >= abort_deadline) {
+        LOG_ERR("Valve didn't reach its safe position within %d ms", ABORT_TIMEOUT_MS);
+        count_to = step_count;
+    }
+}
 
 /// Performs one iteration of the control loop. This must execute very quickly, so any physical actions or
 /// interactions with peripherals should be asynchronous.
 static void step_control_loop(k_work *) {
+    gnc_trace(gnc_trace_event::CONTROL_TICK_START, step_count);
     // Last iter of control loop, execute cleanup tasks. step_count is [1, count_to] for normal iterations,
     // and step_count == count_to+1 for the last cleanup iteration.
     if (step_count > count_to) {
         throttle_valve_stop();
+        redline_disarm();
+        if (mode == control_mode::PRESSURE) {
+            pressure_control_end();
+        }
+        control_active = false;
         // HACK: relinquish control for a little bit to allow client connection to flush data.
         // There really ought to be a cleaner way to do this.
         k_sleep(K_MSEC(100));
         k_msgq_purge(&control_data_msgq); // Signals client connection that no more
+        gnc_trace(gnc_trace_event::CONTROL_TICK_END, step_count);
         return;
     }
 
-    int next_millis = step_count + 1;
-
-    int low_bp_index = MIN(next_millis / gap_millis, std::ssize(breakpoints) - 1);
-    int high_bp_index = low_bp_index + 1;
-    if (low_bp_index < 0) {
-        LOG_WRN("Low index is less than 0, how is that possible? curr: %d, gap: %d", next_millis, gap_millis);
-        low_bp_index = 0;
+    auto now_ms = static_cast<uint32_t>(step_count + 1);
+    while (segment + 1 < num_points && profile[segment + 1].end_ms <= now_ms) {
+        segment += 1;
     }
-    float target;
-    if (high_bp_index >= std::ssize(breakpoints)) {
-        target = breakpoints.back();
+    // Past the last point, its coefficients are zero, so this holds its target.
+    const timed_point &from = profile[segment];
+    auto since = static_cast<float>(now_ms - from.end_ms);
+    float target = from.target + since * (from.c1 + since * (from.c2 + since * from.c3));
+
+    // A stalled ADC never reaches the frame checks, so the ticks watch for one.
+    redline_check_acquisition();
+
+    // Under pressure control, the valve command depends on this tick's chamber reading. Otherwise the valve gets
+    // moving first, and the PTs are read while it does.
+    float target_deg;
+    float pressure_target = NAN;
+    pt_readings readings;
+    if (redline_tripped()) {
+        // The profile is abandoned, and the valve held at its safe position.
+        target_deg = redline_get_safe_deg();
+        throttle_valve_move(target_deg);
+        pts_sample(readings);
+        end_abort_when_safe();
+    } else if (mode == control_mode::PRESSURE) {
+        pressure_target = target;
+        if (pts_sample(readings) == 0 && std::isfinite(readings.ptf401)) {
+            target_deg = pressure_control_step(target, readings.ptf401, throttle_valve_get_pos());
+        } else {
+            // Without a chamber reading, the controller would act on an empty chamber and open the valve wide. The
+            // valve holds instead, until acquisition recovers or the acquisition redline aborts the sequence.
+            LOG_WRN_LIMITED(LOG_INTERVAL_MS, "No chamber reading, holding the valve at %f deg",
+                            static_cast<double>(command_deg));
+            target_deg = command_deg;
+        }
+        throttle_valve_move(target_deg);
     } else {
-        float tween = static_cast<float>(next_millis - (low_bp_index * gap_millis)) / gap_millis;
-        target = breakpoints[low_bp_index] + (breakpoints[high_bp_index] - breakpoints[low_bp_index]) * tween;
+        target_deg = target;
+        throttle_valve_move(target_deg);
+        pts_sample(readings);
     }
-
-
-    // move to target
-    throttle_valve_move(target);
+    command_deg = target_deg;
 
     // Log current data
     // TODO - this copies :/ can we put the message in place?
-    uint64_t since_start = k_cycle_get_64() - start_clock;
-    uint64_t ns_since_start = k_cyc_to_ns_floor64(since_start);
-    pt_readings readings = pts_sample();
-    control_iter_data iter_data = {
-            .time = static_cast<float>(ns_since_start) / 1e9f,
-            .queue_size = k_msgq_num_used_get(&control_data_msgq),
-            .motor_target = target,
-            .motor_pos = throttle_valve_get_pos(),
-            .motor_velocity = throttle_valve_get_velocity(),
-            .motor_acceleration = throttle_valve_get_acceleration(),
-            .motor_nsec_per_pulse = throttle_valve_get_nsec_per_pulse(),
-            .pt202 = readings.pt202,
-            .pt203 = readings.pt203,
-            .ptf401 = readings.ptf401
-    };
+    telemetry_sample iter_data = take_sample(target_deg, pressure_target, readings);
     int err = k_msgq_put(&control_data_msgq, &iter_data, K_NO_WAIT);
+    gnc_trace(gnc_trace_event::MSGQ_PUT, err ? err : static_cast<int32_t>(k_msgq_num_used_get(&control_data_msgq)));
     if (err) {
         // Adding to msgq can only fail with -ENOMSG.
-        LOG_ERR("Control data queue is full! Data is being lost!!!");
+        LOG_ERR_LIMITED(LOG_INTERVAL_MS, "Control data queue is full! Data is being lost!!!");
     }
+    gnc_trace(gnc_trace_event::CONTROL_TICK_END, step_count);
 }
 
 K_WORK_DEFINE(control_loop, step_control_loop);
@@ -122,99 +207,432 @@ static void control_loop_schedule(k_timer *timer) {
 
 K_TIMER_DEFINE(control_loop_schedule_timer, control_loop_schedule, nullptr);
 
+/// Samples for the live stream. Runs in the system workqueue, like control iterations, since reading PTs blocks.
+static void take_stream_sample(k_work *) {
+    if (!control_active) {
+        return;
+    }
+    // There's no target outside of a sequence, so the valve holds where it is.
+    pt_readings readings;
+    pts_sample(readings);
+    telemetry_sample sample = take_sample(throttle_valve_get_pos(), NAN, readings);
+    int err = k_msgq_put(&control_data_msgq, &sample, K_NO_WAIT);
+    gnc_trace(gnc_trace_event::MSGQ_PUT, err ? err : static_cast<int32_t>(k_msgq_num_used_get(&control_data_msgq)));
+    if (err) {
+        LOG_WRN_LIMITED(LOG_INTERVAL_MS, "Stream data queue is full, dropping sample");
+    }
+}
+
+K_WORK_DEFINE(stream_sample, take_stream_sample);
+
+static void stream_schedule(k_timer *) {
+    k_work_submit(&stream_sample);
+}
+
+K_TIMER_DEFINE(stream_schedule_timer, stream_schedule, nullptr);
+
+/*
+ * Between points, the target follows a monotone cubic (Fritsch-Carlson, as in PCHIP) rather than a straight line, so
+ * the valve's commanded velocity is continuous through every point instead of jumping, which the valve could only
+ * follow up to its acceleration limit. Monotone means the curve never overshoots the points: it rises or falls only
+ * where the points do, and is flat through every peak, trough and hold. The profile starts and ends at rest.
+ *
+ * Each point's tangent is the weighted harmonic mean of the slopes on either side, or zero where the slopes differ in
+ * sign. The cubic between two points is then fixed by their targets and tangents, and stored as coefficients so each
+ * control tick costs three multiply-adds.
+ *
+ * A cubic from a hold into a ramp and out to another hold peaks at 1.5 times the ramp's average rate. Where targets are
+ * valve angles, a segment whose cubic would peak faster than the valve can move is a straight line instead, so the
+ * valve lags only through its ends, at its acceleration limit, rather than all the way along.
+ */
+
+/// Fastest the target changes along a segment, in target units per ms. to_c1 is the tangent at the segment's end.
+static float peak_rate(const timed_point &from, float to_c1, float h) {
+    float peak = std::max(std::abs(from.c1), std::abs(to_c1));
+    // The rate is a quadratic in time, so besides the ends it can only peak at its vertex.
+    if (from.c3 != 0.0f) {
+        float vertex = -from.c2 / (3.0f * from.c3);
+        if (vertex > 0.0f && vertex < h) {
+            peak = std::max(peak, std::abs(from.c1 - from.c2 * from.c2 / (3.0f * from.c3)));
+        }
+    }
+    return peak;
+}
+
+/// Computes every segment's coefficients from the points' times and targets. Linear segments without
+/// CONFIG_GNC_PROFILE_SMOOTH, or where a valve angle would change faster than the valve can follow.
+static void fit_profile() {
+    float max_rate = mode == control_mode::VALVE_ANGLE ? throttle_valve_get_max_velocity() / 1000.0f : INFINITY;
+    // Tangents, in target units per ms, go in c1 first, and the remaining coefficients follow from them.
+    for (int i = 0; i < num_points; ++i) {
+        timed_point &point = profile[i];
+        point.c1 = 0.0f;
+        if (!IS_ENABLED(CONFIG_GNC_PROFILE_SMOOTH) || i == 0 || i == num_points - 1) {
+            continue;
+        }
+        auto h0 = static_cast<float>(point.end_ms - profile[i - 1].end_ms);
+        auto h1 = static_cast<float>(profile[i + 1].end_ms - point.end_ms);
+        float slope0 = (point.target - profile[i - 1].target) / h0;
+        float slope1 = (profile[i + 1].target - point.target) / h1;
+        if (slope0 * slope1 > 0.0f) {
+            point.c1 = 3.0f * (h0 + h1) / ((2.0f * h1 + h0) / slope0 + (h1 + 2.0f * h0) / slope1);
+        }
+    }
+    for (int i = 0; i + 1 < num_points; ++i) {
+        timed_point &from = profile[i];
+        const timed_point &to = profile[i + 1];
+        auto h = static_cast<float>(to.end_ms - from.end_ms);
+        float slope = (to.target - from.target) / h;
+        if (IS_ENABLED(CONFIG_GNC_PROFILE_SMOOTH)) {
+            from.c2 = (3.0f * slope - 2.0f * from.c1 - to.c1) / h;
+            from.c3 = (from.c1 + to.c1 - 2.0f * slope) / (h * h);
+            if (peak_rate(from, to.c1, h) <= max_rate) {
+                continue;
+            }
+        }
+        from.c1 = slope;
+        from.c2 = 0.0f;
+        from.c3 = 0.0f;
+    }
+    timed_point &last = profile[num_points - 1];
+    last.c1 = 0.0f;
+    last.c2 = 0.0f;
+    last.c3 = 0.0f;
+}
+
+/// Signals the sender thread that a sequence or stream has started.
+K_SEM_DEFINE(sequence_started, 0, 1);
+
+/// Starts running the prepared sequence. Returns once control iterations are scheduled; the sender thread streams
+/// data to the telemetry subscribers as it comes.
 int sequencer_start_trace() {
-    if (breakpoints.size() < 2) {
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    if (!profile_ready || num_points < 2) {
         LOG_ERR("No breakpoints specified.");
+        k_mutex_unlock(&sequence_lock);
         return 1;
     }
-    if (breakpoints.size() > MAX_BREAKPOINTS) {
-        LOG_ERR("Too many breakpoints: %u", breakpoints.size());
-        return 1;
-    }
-    if (gap_millis < 1) {
-        LOG_ERR("Breakpoint gap_millis is too short: %d ms", gap_millis);
+    if (running) {
+        LOG_ERR(streaming ? "Stop streaming before running a sequence" : "Sequence is already running");
+        k_mutex_unlock(&sequence_lock);
         return 1;
     }
-
-    k_mutex_lock(&sequence_lock, K_FOREVER);
-    if (data_sock == -1) {
-        LOG_ERR("Data socket is not set");
+    if (telemetry_num_subscribers() == 0) {
+        LOG_ERR("No telemetry subscribers");
         k_mutex_unlock(&sequence_lock);
         return 1;
     }
 
-
-    // Replace first breakpoint with current position
-    breakpoints.front() = throttle_valve_get_pos();
-    LOG_INF("Got breakpoints:");
-    for (int i = 0; i < std::ssize(breakpoints); ++i) {
-        LOG_INF("t=%d ms, bp=%f", i * gap_millis, static_cast<double>(breakpoints[i]));
+    // Replace first breakpoint with where the valve, or the chamber, is now, so the sequence starts without a jump.
+    if (mode == control_mode::PRESSURE) {
+        pt_readings readings;
+        if (pts_sample(readings)) {
+            LOG_ERR("No chamber reading to start pressure control from");
+            k_mutex_unlock(&sequence_lock);
+            return 1;
+        }
+        float chamber_psi = readings.ptf401;
+        profile.front().target = chamber_psi;
+        pressure_control_begin(gains, chamber_psi);
+    } else {
+        profile.front().target = throttle_valve_get_pos();
+    }
+    fit_profile();
+    const char *unit = mode == control_mode::PRESSURE ? "psi" : "deg";
+    LOG_INF("Got %d breakpoints over %u ms", num_points, profile[num_points - 1].end_ms);
+    // Long uploaded profiles would flood the log.
+    if (num_points <= SEQUENCER_MAX_BREAKPOINTS) {
+        for (int i = 0; i < num_points; ++i) {
+            LOG_INF("t=%u ms, bp=%f %s", profile[i].end_ms, static_cast<double>(profile[i].target), unit);
+        }
     }
 
     step_count = 0;
-    count_to = (std::ssize(breakpoints) - 1) * gap_millis;
+    count_to = static_cast<int>(profile[num_points - 1].end_ms);
+    segment = 0;
+    abort_deadline = 0;
+    command_deg = throttle_valve_get_pos();
+    running = true;
+    control_active = true;
+    redline_arm();
+    // No flash writes until it's over, since they would stall control ticks.
+    persist_pause();
 
     start_clock = k_cycle_get_64();
 
     // Start control iterations
     k_timer_start(&control_loop_schedule_timer, K_NSEC(NSEC_PER_CONTROL_TICK), K_NSEC(NSEC_PER_CONTROL_TICK));
+    k_sem_give(&sequence_started);
+    k_mutex_unlock(&sequence_lock);
+    return 0;
+}
+
+/// Starts streaming PT and valve samples to the telemetry subscribers at rate_hz, in the same format as sequence data,
+/// until sequencer_stop_stream or until the last subscriber leaves. Refused while a sequence is running.
+int sequencer_start_stream(int rate_hz) {
+    if (rate_hz < 1 || rate_hz > SEQUENCER_MAX_STREAM_HZ) {
+        LOG_ERR("Invalid stream rate: %d Hz", rate_hz);
+        return 1;
+    }
 
-    // Print header
-    send_string_fully(data_sock, ">>>>SEQ START<<<<\n");
-    send_string_fully(data_sock,
-                      "time,queue_size,motor_target,motor_pos,motor_velocity,motor_acceleration,motor_nsec_per_pulse,pt202,pt203,ptf401\n");
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    if (running) {
+        LOG_ERR(streaming ? "Already streaming" : "Can't stream while a sequence is running");
+        k_mutex_unlock(&sequence_lock);
+        return 1;
+    }
+    if (telemetry_num_subscribers() == 0) {
+        LOG_ERR("No telemetry subscribers");
+        k_mutex_unlock(&sequence_lock);
+        return 1;
+    }
 
-    // Dump data as we get it. Connection client is preemptible while control sequence is in system workqueue
-    // (cooperative) so sending data should never block processing of control iter.
-    control_iter_data data = {0};
+    LOG_INF("Streaming at %d Hz", rate_hz);
+    persist_pause();
+    k_msgq_purge(&control_data_msgq);
+    running = true;
+    streaming = true;
+    control_active = true;
+    start_clock = k_cycle_get_64();
+
+    k_timer_start(&stream_schedule_timer, K_NO_WAIT, K_USEC(USEC_PER_SEC / rate_hz));
+    k_sem_give(&sequence_started);
+    k_mutex_unlock(&sequence_lock);
+    return 0;
+}
+
+/// Stops the live stream. The sender thread sends the end marker once it has drained what was already sampled.
+int sequencer_stop_stream() {
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    if (!streaming || !control_active) {
+        k_mutex_unlock(&sequence_lock);
+        return 1;
+    }
+    k_timer_stop(&stream_schedule_timer);
+    control_active = false;
+    k_mutex_unlock(&sequence_lock);
+    return 0;
+}
+
+/// Streams control iteration data to the telemetry subscribers for each sequence. Runs in its own thread so that
+/// starting a sequence never blocks the server.
+[[noreturn]] static void send_sequence_data(void *, void *, void *) {
     while (true) {
-        int err = k_msgq_get(&control_data_msgq, &data, K_FOREVER);
-        // -ENOMSG is sent when queue is purged to signal end of control seq. No other possible
-        // error as we are waiting forever.
-        if (err) {
-            break;
+        k_sem_take(&sequence_started, K_FOREVER);
+        bool is_stream = streaming;
+
+        if (is_stream) {
+            telemetry_begin_stream();
+        } else {
+            telemetry_begin_sequence();
         }
 
-        constexpr int MAX_DATA_LEN = 512;
-        char buf[MAX_DATA_LEN];
-
-        int would_write = snprintfcb(buf, MAX_DATA_LEN, "%.8f,%d,%.8f,%.8f,%.8f,%.8f,%llu,%.8f,%.8f,%.8f\n",
-                                     static_cast<double>(data.time),
-                                     data.queue_size,
-                                     static_cast<double>(data.motor_target), static_cast<double>(data.motor_pos),
-                                     static_cast<double>(data.motor_velocity),
-                                     static_cast<double>(data.motor_acceleration),
-                                     data.motor_nsec_per_pulse,
-                                     static_cast<double>(data.pt202),
-                                     static_cast<double>(data.pt203), static_cast<double>(data.ptf401));
-        // snprintfcb's would_write excludes null byte, but max via MAX_DATA_LEN would include null byte.
-        int actually_written = std::min(would_write, MAX_DATA_LEN - 1);
-        err = send_fully(data_sock, buf, actually_written);
-        if (err) {
-            LOG_WRN("Failed to send data");
+        // Dump data as we get it. This thread is preemptible while control sequence is in system workqueue
+        // (cooperative) so sending data should never block processing of control iter.
+        telemetry_sample data = {};
+        while (true) {
+            int err = k_msgq_get(&control_data_msgq, &data, K_MSEC(100));
+            // -ENOMSG is sent when queue is purged to signal end of control seq. If we weren't waiting at the moment
+            // of the purge, we instead time out and find that control has finished.
+            if (err == -ENOMSG || (err == -EAGAIN && !control_active)) {
+                break;
+            }
+            if (err) {
+                continue;
+            }
+            gnc_trace(gnc_trace_event::MSGQ_GET, static_cast<int32_t>(k_msgq_num_used_get(&control_data_msgq)));
+
+            telemetry_publish(data);
+            // Nobody is left to watch the stream.
+            if (is_stream && telemetry_num_subscribers() == 0) {
+                sequencer_stop_stream();
+            }
         }
+
+        if (is_stream) {
+            telemetry_end_stream();
+        } else {
+            telemetry_end_sequence();
+        }
+
+        k_mutex_lock(&sequence_lock, K_FOREVER);
+        running = false;
+        streaming = false;
+        k_mutex_unlock(&sequence_lock);
+        persist_resume();
     }
+}
 
-    send_string_fully(data_sock, ">>>>SEQ END<<<<\n");
+// Higher priority than client threads, so data gets out promptly.
+K_THREAD_DEFINE(sequencer_sender, 2048, send_sequence_data, nullptr, nullptr, nullptr, 4, 0, 0);
 
-    // Next data recipient should be explicitly re-set.
-    data_sock = -1;
+/// Prepares a sequence of evenly spaced breakpoints, gap ms apart. The first breakpoint is a placeholder for the
+/// valve's starting position.
+int sequencer_prepare(int gap, std::span<const float> bps) {
+    if (gap <= 0 || bps.empty()) {
+        return 1;
+    }
+    if (std::ssize(bps) > SEQUENCER_MAX_BREAKPOINTS) {
+        LOG_ERR("Too many breakpoints: %d", static_cast<int>(std::ssize(bps)));
+        return 1;
+    }
+    if (gap > INT32_MAX / SEQUENCER_MAX_BREAKPOINTS) {
+        LOG_ERR("Breakpoint gap is too long: %d ms", gap);
+        return 1;
+    }
+
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    if (running) {
+        LOG_ERR("Can't prepare a sequence while one is running");
+        k_mutex_unlock(&sequence_lock);
+        return 1;
+    }
+    for (int i = 0; i < std::ssize(bps); ++i) {
+        profile[i] = timed_point{
+                .end_ms = static_cast<uint32_t>(i * gap),
+                .target = bps[i],
+        };
+    }
+    num_points = static_cast<int>(std::ssize(bps));
+    mode = control_mode::VALVE_ANGLE;
+    fit_profile();
+    upload_remaining = 0;
+    profile_ready = true;
     k_mutex_unlock(&sequence_lock);
     return 0;
 }
 
-int sequencer_prepare(int gap, std::vector<float> bps) {
-    if (gap <= 0 || bps.empty()) {
+/// Starts uploading a profile of `length` points, discarding any prepared sequence. The points follow in any number
+/// of sequencer_profile_append calls, and the profile becomes runnable once sequencer_profile_end confirms all of
+/// them arrived. There is one profile store, so a new upload abandons any other in progress.
+int sequencer_profile_begin(int length) {
+    if (length < 1 || length > SEQUENCER_MAX_PROFILE_POINTS) {
+        LOG_ERR("Invalid profile length: %d, max is %d", length, SEQUENCER_MAX_PROFILE_POINTS);
         return 1;
     }
 
-    gap_millis = gap;
-    breakpoints = bps;
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    if (running) {
+        LOG_ERR("Can't upload a profile while a sequence is running");
+        k_mutex_unlock(&sequence_lock);
+        return 1;
+    }
+    // Placeholder for the starting position.
+    profile[0] = timed_point{.end_ms = 0, .target = 0};
+    num_points = 1;
+    mode = control_mode::VALVE_ANGLE;
+    upload_remaining = length;
+    profile_ready = false;
+    k_mutex_unlock(&sequence_lock);
     return 0;
 }
 
-void sequencer_set_data_recipient(int sock) {
+/// Appends points to the profile being uploaded, checking each one. If any point is invalid, the whole upload is
+/// abandoned. Outside an upload, this fails without touching the prepared or running profile.
+int sequencer_profile_append(std::span<const profile_point> points) {
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    if (running || upload_remaining == 0) {
+        LOG_ERR("No profile upload in progress");
+        k_mutex_unlock(&sequence_lock);
+        return 1;
+    }
+    int err = 0;
+    if (std::ssize(points) > upload_remaining) {
+        LOG_ERR("Profile has more points than announced");
+        err = 1;
+    }
+    for (int i = 0; !err && i < std::ssize(points); ++i) {
+        const profile_point &point = points[i];
+        uint64_t end_ms = static_cast<uint64_t>(profile[num_points - 1].end_ms) + point.duration_ms;
+        if (point.duration_ms == 0 || !std::isfinite(point.target_deg)) {
+            LOG_ERR("Invalid profile point %d: %u ms, %f deg", num_points, point.duration_ms,
+                    static_cast<double>(point.target_deg));
+            err = 1;
+        } else if (end_ms > INT32_MAX) {
+            LOG_ERR("Profile is too long");
+            err = 1;
+        } else {
+            profile[num_points] = timed_point{
+                    .end_ms = static_cast<uint32_t>(end_ms),
+                    .target = point.target_deg,
+            };
+            num_points += 1;
+            upload_remaining -= 1;
+        }
+    }
+    if (err) {
+        num_points = 0;
+        upload_remaining = 0;
+    }
+    k_mutex_unlock(&sequence_lock);
+    return err;
+}
+
+/// Finishes a profile upload, making it the prepared sequence if every announced point arrived.
+int sequencer_profile_end() {
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    int err = 0;
+    if (running || num_points < 1 || profile_ready) {
+        LOG_ERR("No profile upload in progress");
+        err = 1;
+    } else if (upload_remaining != 0) {
+        LOG_ERR("Profile upload is missing %d points", upload_remaining);
+        num_points = 0;
+        upload_remaining = 0;
+        err = 1;
+    } else {
+        fit_profile();
+        profile_ready = true;
+    }
+    k_mutex_unlock(&sequence_lock);
+    return err;
+}
+
+/// Switches the prepared sequence to closed-loop chamber pressure control with the given gains, reading its targets as
+/// pressures in psi rather than valve angles. Lasts until another sequence is prepared.
+int sequencer_set_pressure_control(const pressure_gains &new_gains) {
+    if (!pressure_gains_valid(new_gains)) {
+        LOG_ERR("Invalid pressure control gains");
+        return 1;
+    }
+
+    k_mutex_lock(&sequence_lock, K_FOREVER);
+    int err = 0;
+    if (running || !profile_ready) {
+        LOG_ERR("No sequence prepared");
+        err = 1;
+    }
+    // The first point is a placeholder, replaced at the start.
+    for (int i = 1; !err && i < num_points; ++i) {
+        if (profile[i].target < 0.0f) {
+            LOG_ERR("Invalid pressure target %d: %f psi", i, static_cast<double>(profile[i].target));
+            err = 1;
+        }
+    }
+    if (!err) {
+        mode = control_mode::PRESSURE;
+        gains = new_gains;
+    }
+    k_mutex_unlock(&sequence_lock);
+    return err;
+}
+
+/// Duration of the prepared sequence, or 0 if there is none.
+int sequencer_get_duration_ms() {
     k_mutex_lock(&sequence_lock, K_FOREVER);
-    data_sock = sock;
+    int duration = profile_ready && num_points > 0 ? static_cast<int>(profile[num_points - 1].end_ms) : 0;
     k_mutex_unlock(&sequence_lock);
+    return duration;
+}
+
+#ifdef CONFIG_ZTEST
+/// Runs control iteration `step` of the prepared profile directly, without the control timer, so tests can time it.
+/// step must be within the profile, and nothing may be running. Earlier iterations' samples are discarded first.
+void sequencer_bench_control_iteration(int step) {
+    k_msgq_purge(&control_data_msgq);
+    step_count = step;
+    count_to = static_cast<int>(profile[num_points - 1].end_ms);
+    segment = 0;
+    step_control_loop(nullptr);
 }
+#endif
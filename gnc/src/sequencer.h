@@ -1,12 +1,49 @@
 #ifndef CLOVER_SEQUENCER_H
 #define CLOVER_SEQUENCER_H
 
-#include <vector>
+#include <cstdint>
+#include <span>
 
-int sequencer_prepare(int gap, std::vector<float> bps);
+#include "pressure_control.h"
+
+/// Most breakpoints a sequence prepared in one go with sequencer_prepare may have, including the implicit starting
+/// breakpoint. Longer profiles are uploaded in chunks instead.
+constexpr int SEQUENCER_MAX_BREAKPOINTS = 20;
+
+/// Most points an uploaded profile may have, not counting the implicit starting point.
+constexpr int SEQUENCER_MAX_PROFILE_POINTS = CONFIG_GNC_PROFILE_MAX_POINTS;
+
+/// Fastest rate a live stream may sample at. Matches the control loop.
+constexpr int SEQUENCER_MAX_STREAM_HZ = 1000;
+
+/// One point of a throttle profile: the valve moves from the previous point to target_deg over duration_ms, along a
+/// monotone cubic through the points. It moves linearly without CONFIG_GNC_PROFILE_SMOOTH, and on any segment where the
+/// cubic would outrun the valve. Under pressure control, target_deg is a chamber pressure in psi instead.
+struct profile_point {
+    uint32_t duration_ms;
+    float target_deg;
+};
+
+int sequencer_prepare(int gap, std::span<const float> bps);
+
+int sequencer_profile_begin(int num_points);
+
+int sequencer_profile_append(std::span<const profile_point> points);
+
+int sequencer_profile_end();
+
+int sequencer_set_pressure_control(const pressure_gains &gains);
+
+int sequencer_get_duration_ms();
 
 int sequencer_start_trace();
 
-void sequencer_set_data_recipient(int sock);
+int sequencer_start_stream(int rate_hz);
+
+int sequencer_stop_stream();
+
+#ifdef CONFIG_ZTEST
+void sequencer_bench_control_iteration(int step);
+#endif
 
 #endif //CLOVER_SEQUENCER_H
@@ -1,33 +1,24 @@
-#include <cctype>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/socket.h>
 #include <zephyr/sys/errno_private.h>
 #include <zephyr/net/net_pkt.h>
-#include <sstream>
-#include <string>
-#include <array>
+#include <zephyr/sys/printk.h>
+
+#include <gnc/rpc_protocol.h>
 
-#include "throttle_valve.h"
 #include "server.h"
+#include "boot.h"
 #include "guards/SocketGuard.h"
-#include "pts.h"
-#include "sequencer.h"
+#include "commands.h"
+#include "rpc.h"
+#include "telemetry.h"
+#include "gnc_trace.h"
+#include "heap_check.h"
 
 
 LOG_MODULE_REGISTER(Server, CONFIG_LOG_DEFAULT_LEVEL);
 
-#define MAX_OPEN_CLIENTS 4
-
-/// Main server thread must acquire one of these before accepting a connection. It must then scan through the thread
-/// array to find an open slot.
-K_SEM_DEFINE(num_open_connections, MAX_OPEN_CLIENTS, MAX_OPEN_CLIENTS);
-
-bool has_thread[MAX_OPEN_CLIENTS] = {false};
-K_MUTEX_DEFINE(has_thread_lock);
-
-static k_thread client_threads[MAX_OPEN_CLIENTS] = {nullptr};
-#define CONNECTION_THREAD_STACK_SIZE (4 * 1024)
-K_THREAD_STACK_ARRAY_DEFINE(client_stacks, MAX_OPEN_CLIENTS, CONNECTION_THREAD_STACK_SIZE);
+#define MAX_OPEN_CLIENTS CONFIG_GNC_SERVER_MAX_CLIENTS
 
 /// Helper that sends a payload completely through an socket
 int send_fully(int sock, const char *buf, int len) {
@@ -35,6 +26,7 @@ int send_fully(int sock, const char *buf, int len) {
     while (bytes_sent < len) {
         int ret = zsock_send(sock, buf + bytes_sent,
                              len - bytes_sent, 0);
+        gnc_trace(gnc_trace_event::SOCKET_SEND, ret);
         if (ret < 0) {
             LOG_ERR("Unexpected error while sending response: err %d", ret);
             return ret;
@@ -44,235 +36,98 @@ int send_fully(int sock, const char *buf, int len) {
     return 0;
 }
 
-int send_string_fully(int sock, const std::string &payload) {
-    return send_fully(sock, payload.c_str(), std::ssize(payload));
+/// Steps iov past the first sent bytes, so it describes only what is left.
+void iov_advance(iovec *&iov, int &iov_count, size_t sent) {
+    while (iov_count > 0 && sent >= iov->iov_len) {
+        sent -= iov->iov_len;
+        ++iov;
+        --iov_count;
+    }
+    if (iov_count > 0) {
+        iov->iov_base = static_cast<uint8_t *>(iov->iov_base) + sent;
+        iov->iov_len -= sent;
+    }
 }
 
-/// Handles a client connection. Should run in its own thread.
-static void handle_client(void *p1_client_socket, void *, void *) {
-    SocketGuard client_guard{reinterpret_cast<int>(p1_client_socket)};
-    LOG_INF("Handling socket: %d", client_guard.socket);
-    k_sleep(K_MSEC(500));
+/// Sends every byte described by iov, gathering the pieces from wherever they already are rather than copying them
+/// into one buffer first. The iovecs are consumed: on return, they describe whatever was left unsent.
+int send_iov_fully(int sock, iovec *iov, int iov_count) {
+    while (iov_count > 0) {
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        ssize_t ret = zsock_sendmsg(sock, &msg, 0);
+        gnc_trace(gnc_trace_event::SOCKET_SEND, ret < 0 ? -errno : static_cast<int32_t>(ret));
+        if (ret < 0) {
+            LOG_ERR("Unexpected error while sending response: errno %d", errno);
+            return -errno;
+        }
+        iov_advance(iov, iov_count, static_cast<size_t>(ret));
+    }
+    return 0;
+}
 
-    while (true) {
-        // Read one byte at a time till we get a #-terminated command
-        constexpr int MAX_COMMAND_LEN = 512;
-        char command_buf[MAX_COMMAND_LEN + 1];
-        int next_command_byte = 0;
-        while (true) {
-            ssize_t bytes_read = zsock_recv(client_guard.socket, command_buf + next_command_byte, 1, 0);
+/// Per-connection buffers, one per client slot.
+static client_context client_contexts[MAX_OPEN_CLIENTS];
+
+/// Reads once from a client and handles everything that read completed. Blocks in recv if nothing is available, so
+/// the event loop only calls this once the socket is readable. Returns 0 if the connection should stay open, or a
+/// negative errno.
+static int client_service(client_context &ctx) {
+    switch (ctx.protocol) {
+        case client_protocol::UNKNOWN: {
+            // Peek at the first byte to tell which protocol the client speaks.
+            uint8_t first_byte;
+            ssize_t bytes_read = zsock_recv(ctx.socket, &first_byte, 1, ZSOCK_MSG_PEEK);
             if (bytes_read < 0) {
                 LOG_WRN("Failed to read bytes: errno %d", errno);
-                return;
-            }
-            if (bytes_read) {
-                // Ignore whitespace
-                if (std::isspace(command_buf[next_command_byte])) {
-                    continue;
-                }
-                if (command_buf[next_command_byte] == '#') {
-                    command_buf[next_command_byte + 1] = '\0';
-                    break;
-                }
+                return -errno;
             }
-            next_command_byte += bytes_read;
-            if (next_command_byte == MAX_COMMAND_LEN) {
-                LOG_WRN("Didn't find command terminator `#` after %d bytes", MAX_COMMAND_LEN);
-                return;
+            if (bytes_read == 0) {
+                LOG_INF("Client closed connection");
+                return -ECONNRESET;
             }
+            ctx.protocol = first_byte == RPC_MAGIC[0] ? client_protocol::RPC_HANDSHAKE : client_protocol::TEXT;
+            return 0;
         }
-
-        LOG_INF("Got command: %s", command_buf);
-        std::string command(command_buf); // TODO: Heap allocation? perhaps stick with annoying cstring?
-
-        if (command == "calibrate#") {
-            throttle_valve_start_calibrate();
-            send_string_fully(client_guard.socket, "Done calibrating\n");
-        } else if (command == "resetopen#") {
-            // Sets the current position as 90 deg WITHOUT moving the valve.
-            throttle_valve_set_open();
-            send_string_fully(client_guard.socket, "Done reset open\n");
-        } else if (command == "resetclose#") {
-            // Sets the current position as 0 deg WITHOUT moving the valve.
-            throttle_valve_set_closed();
-            send_string_fully(client_guard.socket, "Done reset close\n");
-        } else if (command.starts_with("seq")) {
-            // Example: seq500;75.5,52.0,70,90, where 500 -> 500ms between each breakpoint and
-            // the commas-seperated values are the breakpoints in degrees.
-            // NOTE: An initial breakpoint, representing the valve current starting position,
-            // is implicitly added. Thus, the example shown will run for 2s as we actually start
-            // at, say, 90 deg.
-            // Also, please do not give invalid input :) :) :)
-
-            std::vector<float> seq_breakpoints;
-
-            // Mini token parser
-            int gap = 0;
-            seq_breakpoints.clear();
-            seq_breakpoints.push_back(throttle_valve_get_pos());
-            bool wrote_gap = false;
-            int curr_token = 0;
-            bool is_neg = false;
-            for (int i = 3; i < std::ssize(command) - 1; ++i) {
-                if (!(command[i] >= '0' && command[i] <= '9')) {
-                    if (command[i] == '-') {
-                        is_neg = true;
-                    } else if (wrote_gap) {
-                        if (is_neg) {
-                            curr_token = -curr_token;
-                        }
-                        seq_breakpoints.push_back(curr_token);
-                        is_neg = false;
-                    } else {
-                        gap = curr_token;
-                        wrote_gap = true;
-                    }
-                    curr_token = 0;
-                } else {
-                    curr_token = 10 * curr_token + (command[i] - '0');
-                }
+        case client_protocol::RPC_HANDSHAKE: {
+            int ret = rpc_read_magic(ctx);
+            if (ret > 0) {
+                ctx.protocol = client_protocol::RPC;
             }
-            if (is_neg) {
-                curr_token = -curr_token;
-            }
-            seq_breakpoints.push_back(curr_token);
-            is_neg = false;
+            return ret < 0 ? ret : 0;
+        }
+        case client_protocol::TEXT:
+            return commands_service(ctx);
+        case client_protocol::RPC:
+            return rpc_service(ctx);
+    }
+    return -EINVAL;
+}
 
-            if (seq_breakpoints.size() <= 1) {
-                send_string_fully(client_guard.socket, "Breakpoints too short\n");
-                continue;
-            }
-            int time_ms = (std::ssize(seq_breakpoints) - 1) * gap;
-            if (sequencer_prepare(gap, seq_breakpoints)) {
-                send_string_fully(client_guard.socket, "Failed to prepare sequence");
-                continue;
-            }
-            std::string msg = "Breakpoints prepared, length is: " + std::to_string(time_ms) + "ms\n";
-            send_string_fully(client_guard.socket, msg.c_str());
-
-        } else if (command == "getpos#") {
-            double pos = throttle_valve_get_pos();
-            std::string payload = "valve pos: " + std::to_string(pos) + " deg\n";
-            int err = send_fully(client_guard.socket, payload.c_str(), std::ssize(payload));
-            if (err) {
-                LOG_ERR("Failed to fully send valve pos: err %d", err);
-            }
+#ifndef CONFIG_GNC_SERVER_EVENT_LOOP
 
-        } else if (command == "getpts#") {
-            pt_readings readings = pts_sample();
-            std::string payload =
-                    "pt203: " + std::to_string(readings.pt203) + ", pt202: " + std::to_string(readings.pt203) +
-                    ", ptf401: " + std::to_string(readings.ptf401) + ", pt102: " + std::to_string(readings.pt102) +
-                    "\n";
-            int err = send_fully(client_guard.socket, payload.c_str(), std::ssize(payload));
-            if (err) {
-                LOG_ERR("Failed to fully send pt readings: err %d", err);
-            }
-        } else if (command == "START#") {
-            send_string_fully(client_guard.socket, "ACK#");
-            // Triggered in DAQ sequencer.
-            LOG_INF("Triggering sequence from DAQ.");
-            int err = sequencer_start_trace();
-            if (err) {
-                LOG_ERR("Failed to run sequence: err %d", err);
-                continue;
-            }
-        } else if (command == "listen#") {
-            send_string_fully(client_guard.socket,
-                              "Don't send additional commands till the sequence is done, lest the output be mangled.\n");
-            send_string_fully(client_guard.socket, "Listening for sequence...\n");
-            sequencer_set_data_recipient(client_guard.socket);
-        } else if (command == "dstart#") {
-            // Triggered manually.
-            sequencer_set_data_recipient(client_guard.socket);
-            int err = sequencer_start_trace();
-            if (err) {
-                LOG_ERR("Failed to run sequence: err %d", err);
-                send_string_fully(client_guard.socket, "Failed to run sequence\n");
-                continue;
-            }
-            send_string_fully(client_guard.socket, "Done sequence.\n");
-        } else if (command.starts_with("configpt")) {
-            // Configure the pt bias as such:
-            // configptbias,pt203,-5#
-            // Or set the PT range (e.g., 1k PT) as such:
-            // configptrang,pt203,2000#
-
-            bool config_bias_not_range = false;
-            std::string config_what = command.substr(8, 4);
-            if (config_what == "bias") {
-                config_bias_not_range = true;
-            } else if (config_what == "rang") {
-                config_bias_not_range = false;
-            } else {
-                LOG_ERR("Invalid config option for PT");
-                continue;
-            }
+/// Main server thread must acquire one of these before accepting a connection. It must then scan through the thread
+/// array to find an open slot.
+K_SEM_DEFINE(num_open_connections, MAX_OPEN_CLIENTS, MAX_OPEN_CLIENTS);
 
-            std::string pt_name;
-            float value = 0;
-            bool bias_is_negative = false;
-            bool in_label_segment = true;
-            for (int i = 12; i < std::ssize(command) - 1; ++i) {
-                if (command[i] != ',') {
-                    if (in_label_segment) {
-                        pt_name += command[i];
-                    } else {
-                        if (command[i] == '-') {
-                            bias_is_negative = true;
-                        } else {
-                            value = value * 10.0f + static_cast<float>(command[i] - '0');
-                        }
-                    }
-                } else {
-                    in_label_segment = false;
-                }
-            }
-            if (bias_is_negative) {
-                value *= -1;
-            }
+bool has_thread[MAX_OPEN_CLIENTS] = {false};
+K_MUTEX_DEFINE(has_thread_lock);
 
-            int pt_index = -1;
-            if (pt_name == "pt202") {
-                pt_index = 1;
-            } else if (pt_name == "pt203") {
-                pt_index = 2;
-            } else if (pt_name == "ptf401") {
-                pt_index = 3;
-            } else {
-                LOG_ERR("Invalid pt name: %s", pt_name.c_str());
-                continue;
-            }
+static k_thread client_threads[MAX_OPEN_CLIENTS] = {nullptr};
+#define CONNECTION_THREAD_STACK_SIZE (4 * 1024)
+K_THREAD_STACK_ARRAY_DEFINE(client_stacks, MAX_OPEN_CLIENTS, CONNECTION_THREAD_STACK_SIZE);
 
-            int err = 0;
-            if (config_bias_not_range) {
-                err = pts_set_bias(pt_index, value);
-            } else {
-                err = pts_set_range(pt_index, value);
-            }
-            if (err) {
-                LOG_ERR("Failed to set PT bias: err %d", err);
-                continue;
-            }
+/// Handles a client connection. Should run in its own thread.
+static void handle_client(void *p1_client_socket, void *p2_slot, void *) {
+    SocketGuard client_guard{reinterpret_cast<int>(p1_client_socket)};
+    LOG_INF("Handling socket: %d", client_guard.socket);
 
-            send_string_fully(client_guard.socket, "Set PT bias.");
-        } else if (command == "getptconfigs#") {
-            std::string payload;
-            std::array<std::string, 4> index_to_pt{
-                    "UNUSED",
-                    "pt202",
-                    "pt203",
-                    "ptf401"
-            };
-            for (int i = 1; i < 4; ++i) {
-                payload += index_to_pt[i] + ": bias=" + std::to_string(pt_configs[i].bias) + "psig, range=" +
-                           std::to_string(pt_configs[i].range) + "psig\n";
-            }
-            send_string_fully(client_guard.socket, payload);
-        } else {
-            LOG_WRN("Unknown command.");
-        }
+    client_context &ctx = client_contexts[reinterpret_cast<int>(p2_slot)];
+    ctx.reset(client_guard.socket);
+    while (client_service(ctx) == 0) {
     }
+    telemetry_unsubscribe(ctx.socket);
 }
 
 /// Attempts to join connection handler threads, allowing the thread slots to be reused to service new connection.
@@ -310,44 +165,12 @@ static void handle_client(void *p1_client_socket, void *, void *) {
 
 K_THREAD_DEFINE(server_reaper, 1024, reap_dead_connections, nullptr, nullptr, nullptr, 1, 0, 0);
 
-
-/// Opens a TCP server, listens for incoming clients, and spawns new threads to serve these connections. This function
-/// blocks indefinitely.
-void serve_connections() {
-    LOG_INF("Opening socket");
-    k_sleep(K_MSEC(500));
-    LOG_INF("Opening socket");
-    k_sleep(K_MSEC(500));
-    int server_socket = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (server_socket < 0) {
-        LOG_ERR("Failed to create TCP socket: %d", errno);
-        return;
-    }
-    LOG_INF("HEY!");
-    k_sleep(K_MSEC(500));
-
-    sockaddr_in bind_addr = {};
-    bind_addr.sin_family = AF_INET;
-    bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    bind_addr.sin_port = htons(19690);
-
-    LOG_INF("Binding socket to address");
-    int err = zsock_bind(server_socket, reinterpret_cast<sockaddr *>(&bind_addr), sizeof(bind_addr));
-    if (err) {
-        LOG_ERR("Failed to bind to socket `%d`: %d", server_socket, err);
-        return;
-    }
-    LOG_INF("Listening for open connections");
-    err = zsock_listen(server_socket, 0);
-    if (err) {
-        LOG_ERR("Failed to listen on socket `%d`: %d", server_socket, err);
-        return;
-    }
-
+/// Accepts clients and spawns a thread in a free slot to serve each one.
+static void serve_threaded(int server_socket) {
     // Serve new connections indefinitely
     while (true) {
         // Wait for free thread slot
-        err = k_sem_take(&num_open_connections, K_FOREVER);
+        int err = k_sem_take(&num_open_connections, K_FOREVER);
         if (err) {
             LOG_INF("Failed to acquire semaphore: %d", err);
             return;
@@ -374,11 +197,127 @@ void serve_connections() {
                         reinterpret_cast<k_thread_stack_t *>(&client_stacks[connection_index]),
                         CONNECTION_THREAD_STACK_SIZE,
                         handle_client,
-                        reinterpret_cast<void *>(client_socket), nullptr, nullptr, 5, 0, K_NO_WAIT
+                        reinterpret_cast<void *>(client_socket), reinterpret_cast<void *>(connection_index), nullptr,
+                        5, 0, K_FOREVER
         );
+        // Named per slot before it runs, so stats# and traces can tell clients apart from the start.
+        char thread_name[16];
+        snprintk(thread_name, sizeof(thread_name), "client %d", connection_index);
+        k_thread_name_set(&client_threads[connection_index], thread_name);
+        k_thread_start(&client_threads[connection_index]);
 
         k_mutex_lock(&has_thread_lock, K_FOREVER);
         has_thread[connection_index] = true;
         k_mutex_unlock(&has_thread_lock);
     }
 }
+
+#else
+
+/// Listening socket at index 0, then one entry per client slot. Free slots have a negative fd, which poll ignores.
+static zsock_pollfd poll_fds[1 + MAX_OPEN_CLIENTS];
+
+static void accept_client(int server_socket) {
+    int client_socket = zsock_accept(server_socket, nullptr, nullptr);
+    if (client_socket < 0) {
+        LOG_ERR("Failed to accept client: errno %d", errno);
+        return;
+    }
+    for (int slot = 0; slot < MAX_OPEN_CLIENTS; ++slot) {
+        if (poll_fds[slot + 1].fd < 0) {
+            LOG_INF("Serving socket %d in slot %d", client_socket, slot);
+            client_contexts[slot].reset(client_socket);
+            poll_fds[slot + 1].fd = client_socket;
+            return;
+        }
+    }
+    LOG_WRN("No free client slots, rejecting socket %d", client_socket);
+    zsock_close(client_socket);
+}
+
+static void close_client(int slot) {
+    client_context &ctx = client_contexts[slot];
+    LOG_INF("Freed slot %d", slot);
+    telemetry_unsubscribe(ctx.socket);
+    zsock_close(ctx.socket);
+    ctx.socket = -1;
+    poll_fds[slot + 1].fd = -1;
+}
+
+/// Serves the listening socket and every client from this one thread. Each client is a state machine in its
+/// client_context that advances by one read whenever poll reports it readable. Handlers run inline, so a long one
+/// (calibrate#) holds up every client until it is done.
+static void serve_event_loop(int server_socket) {
+    poll_fds[0] = {.fd = server_socket, .events = ZSOCK_POLLIN, .revents = 0};
+    for (int slot = 0; slot < MAX_OPEN_CLIENTS; ++slot) {
+        poll_fds[slot + 1] = {.fd = -1, .events = ZSOCK_POLLIN, .revents = 0};
+    }
+
+    while (true) {
+        int ret = zsock_poll(poll_fds, ARRAY_SIZE(poll_fds), -1);
+        if (ret < 0) {
+            LOG_ERR("Failed to poll sockets: errno %d", errno);
+            return;
+        }
+
+        if (poll_fds[0].revents & ZSOCK_POLLIN) {
+            accept_client(server_socket);
+        }
+        for (int slot = 0; slot < MAX_OPEN_CLIENTS; ++slot) {
+            short revents = poll_fds[slot + 1].revents;
+            if (poll_fds[slot + 1].fd < 0 || !revents) {
+                continue;
+            }
+            // Read before acting on a hangup, there may still be commands buffered.
+            if (revents & ZSOCK_POLLIN) {
+                if (client_service(client_contexts[slot]) < 0) {
+                    close_client(slot);
+                }
+            } else if (revents & (ZSOCK_POLLERR | ZSOCK_POLLHUP | ZSOCK_POLLNVAL)) {
+                close_client(slot);
+            }
+        }
+    }
+}
+
+#endif
+
+/// Opens a TCP server and serves incoming clients, either with a thread per client or from a single event loop. This
+/// function blocks indefinitely.
+void serve_connections() {
+    LOG_INF("Opening socket");
+    int server_socket = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (server_socket < 0) {
+        LOG_ERR("Failed to create TCP socket: %d", errno);
+        boot_stage_end(boot_stage::SERVER, -errno);
+        return;
+    }
+
+    sockaddr_in bind_addr = {};
+    bind_addr.sin_family = AF_INET;
+    bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    bind_addr.sin_port = htons(19690);
+
+    LOG_INF("Binding socket to address");
+    int err = zsock_bind(server_socket, reinterpret_cast<sockaddr *>(&bind_addr), sizeof(bind_addr));
+    if (err) {
+        LOG_ERR("Failed to bind to socket `%d`: %d", server_socket, err);
+        boot_stage_end(boot_stage::SERVER, err);
+        return;
+    }
+    LOG_INF("Listening for open connections");
+    err = zsock_listen(server_socket, 0);
+    if (err) {
+        LOG_ERR("Failed to listen on socket `%d`: %d", server_socket, err);
+        boot_stage_end(boot_stage::SERVER, err);
+        return;
+    }
+    boot_stage_end(boot_stage::SERVER, 0);
+    heap_check_seal();
+
+#ifdef CONFIG_GNC_SERVER_EVENT_LOOP
+    serve_event_loop(server_socket);
+#else
+    serve_threaded(server_socket);
+#endif
+}
@@ -1,12 +1,14 @@
 #ifndef CLOVER_SERVER_H
 #define CLOVER_SERVER_H
 
-#include <string>
+#include <zephyr/net/socket.h>
 
 void serve_connections();
 
 int send_fully(int sock, const char *buf, int len);
 
-int send_string_fully(int sock, const std::string &payload);
+void iov_advance(iovec *&iov, int &iov_count, size_t sent);
+
+int send_iov_fully(int sock, iovec *iov, int iov_count);
 
 #endif //CLOVER_SERVER_H
@@ -0,0 +1,185 @@
+#include "stats.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/net_pkt.h>
+#include <zephyr/net_buf.h>
+#include <cstdint>
+#include <cstring>
+
+#include "heap_check.h"
+#include "log_limit.h"
+
+LOG_MODULE_REGISTER(stats, CONFIG_LOG_DEFAULT_LEVEL);
+
+/// Most threads reported on. There are around a dozen with every client slot in use.
+constexpr int MAX_THREADS = 32;
+/// Longest line of the report, so the reply can be flushed before it would overflow.
+constexpr int MAX_LINE_LEN = 96;
+
+struct thread_stats {
+    const k_thread *thread;
+    char name[CONFIG_THREAD_MAX_NAME_LEN];
+    /// Cycles the thread has run for since boot.
+    uint64_t cycles;
+    size_t stack_size;
+    size_t stack_unused;
+};
+
+/// Snapshot of every thread, filled in by collect_thread.
+static thread_stats threads[MAX_THREADS];
+static int num_threads = 0;
+
+/// Each thread's cycle count as of the last report, so CPU usage covers the time since then rather than since boot.
+struct thread_cycles {
+    const k_thread *thread;
+    uint64_t cycles;
+};
+static thread_cycles last_cycles[MAX_THREADS];
+static int num_last_cycles = 0;
+static uint64_t last_report_cycles = 0;
+
+/// Serializes reports, which share the snapshots above.
+K_MUTEX_DEFINE(stats_lock);
+
+/// Called for each thread, without the thread list locked, so measuring the stack doesn't hold off the scheduler.
+static void collect_thread(const k_thread *thread, void *) {
+    if (num_threads == MAX_THREADS) {
+        return;
+    }
+    auto *tid = const_cast<k_thread *>(thread);
+    thread_stats &stats = threads[num_threads++];
+    stats.thread = thread;
+
+    const char *name = k_thread_name_get(tid);
+    strncpy(stats.name, name != nullptr && name[0] != '\0' ? name : "?", sizeof(stats.name) - 1);
+    stats.name[sizeof(stats.name) - 1] = '\0';
+
+    k_thread_runtime_stats_t runtime;
+    stats.cycles = k_thread_runtime_stats_get(tid, &runtime) == 0 ? runtime.execution_cycles : 0;
+
+    stats.stack_size = thread->stack_info.size;
+    if (k_thread_stack_space_get(thread, &stats.stack_unused) != 0) {
+        stats.stack_unused = 0;
+    }
+}
+
+/// Cycles the thread had run for as of the last report, or 0 if it is new since.
+static uint64_t cycles_at_last_report(const k_thread *thread) {
+    for (int i = 0; i < num_last_cycles; ++i) {
+        if (last_cycles[i].thread == thread) {
+            return last_cycles[i].cycles;
+        }
+    }
+    return 0;
+}
+
+/// Sends the reply so far if another line might not fit.
+static int make_room(ReplyBuffer &reply, int sock) {
+    if (reply.available() >= MAX_LINE_LEN) {
+        return 0;
+    }
+    return reply.flush(sock);
+}
+
+#ifdef CONFIG_NET_NATIVE
+static int report_slab(ReplyBuffer &reply, int sock, const char *name, k_mem_slab *slab) {
+    int err = make_room(reply, sock);
+    if (err) {
+        return err;
+    }
+#ifdef CONFIG_MEM_SLAB_TRACE_MAX_UTILIZATION
+    reply.appendf("  %s: %u/%u used, peak %u\n", name, k_mem_slab_num_used_get(slab), slab->info.num_blocks,
+                  k_mem_slab_max_used_get(slab));
+#else
+    reply.appendf("  %s: %u/%u used\n", name, k_mem_slab_num_used_get(slab), slab->info.num_blocks);
+#endif
+    return 0;
+}
+
+static int report_pool(ReplyBuffer &reply, int sock, const char *name, net_buf_pool *pool) {
+    int err = make_room(reply, sock);
+    if (err) {
+        return err;
+    }
+#ifdef CONFIG_NET_BUF_POOL_USAGE
+    reply.appendf("  %s: %ld/%u used\n", name, static_cast<long>(pool->buf_count - atomic_get(&pool->avail_count)),
+                  pool->buf_count);
+#else
+    reply.appendf("  %s: %u bufs\n", name, pool->buf_count);
+#endif
+    return 0;
+}
+#endif
+
+/// Appends per-thread CPU usage since the last report, stack usage against each stack's size, and net packet and
+/// buffer pool usage. The report can outgrow the reply buffer, so it is sent to sock in parts as it fills. Returns 0 or
+/// a negative errno from sending.
+int stats_report(ReplyBuffer &reply, int sock) {
+    k_mutex_lock(&stats_lock, K_FOREVER);
+
+    num_threads = 0;
+    uint64_t now = k_cycle_get_64();
+    k_thread_foreach_unlocked(collect_thread, nullptr);
+    uint64_t elapsed = now - last_report_cycles;
+
+    int err = 0;
+    reply.appendf("threads (cpu over last %llu ms, stack used/size in bytes):\n",
+                  k_cyc_to_ms_floor64(elapsed));
+    for (int i = 0; i < num_threads && !err; ++i) {
+        const thread_stats &stats = threads[i];
+        uint64_t ran = stats.cycles - cycles_at_last_report(stats.thread);
+        auto permille = static_cast<unsigned int>(elapsed > 0 ? ran * 1000 / elapsed : 0);
+        err = make_room(reply, sock);
+        if (!err) {
+            reply.appendf("  %-20s %3u.%u%% cpu, stack %u/%u\n", stats.name, permille / 10, permille % 10,
+                          static_cast<unsigned int>(stats.stack_size - stats.stack_unused),
+                          static_cast<unsigned int>(stats.stack_size));
+        }
+    }
+
+    for (int i = 0; i < num_threads; ++i) {
+        last_cycles[i] = {threads[i].thread, threads[i].cycles};
+    }
+    num_last_cycles = num_threads;
+    last_report_cycles = now;
+
+    if (!err) {
+        err = make_room(reply, sock);
+    }
+    if (!err) {
+        reply.appendf("log: %u messages rate-limited\n", log_limit_total_suppressed());
+    }
+#ifdef CONFIG_GNC_HEAP_CHECK
+    if (!err) {
+        err = make_room(reply, sock);
+    }
+    if (!err) {
+        heap_check_report(reply);
+    }
+#endif
+
+#ifdef CONFIG_NET_NATIVE
+    if (!err) {
+        k_mem_slab *rx;
+        k_mem_slab *tx;
+        net_buf_pool *rx_data;
+        net_buf_pool *tx_data;
+        net_pkt_get_info(&rx, &tx, &rx_data, &tx_data);
+        reply.append("net:\n");
+        err = report_slab(reply, sock, "rx pkts", rx);
+        if (!err) {
+            err = report_slab(reply, sock, "tx pkts", tx);
+        }
+        if (!err) {
+            err = report_pool(reply, sock, "rx bufs", rx_data);
+        }
+        if (!err) {
+            err = report_pool(reply, sock, "tx bufs", tx_data);
+        }
+    }
+#endif
+
+    k_mutex_unlock(&stats_lock);
+    return err;
+}
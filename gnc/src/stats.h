@@ -0,0 +1,8 @@
+#ifndef CLOVER_STATS_H
+#define CLOVER_STATS_H
+
+#include "reply_buffer.h"
+
+int stats_report(ReplyBuffer &reply, int sock);
+
+#endif //CLOVER_STATS_H
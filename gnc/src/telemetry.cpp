@@ -0,0 +1,401 @@
+#include "telemetry.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/sys/cbprintf.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <span>
+#include <string_view>
+
+#include "server.h"
+#include "gnc_trace.h"
+
+LOG_MODULE_REGISTER(telemetry, CONFIG_LOG_DEFAULT_LEVEL);
+
+/// How long a TCP subscriber gets to make room for stream framing, or for the rest of a partly sent record, before
+/// it's assumed stalled and unsubscribed.
+constexpr int STALL_TIMEOUT_MS = 100;
+
+/// A subscriber that has had to skip this many records in a row is assumed gone and unsubscribed, so a dead client
+/// doesn't cost a failed send per record forever.
+constexpr uint32_t MAX_CONSECUTIVE_DROPS = 5000;
+
+struct telemetry_subscriber {
+    /// Connection that owns the subscription. For TCP subscribers, this is also where records are sent.
+    int sock = -1;
+    /// Whether records go out as datagrams to udp_addr rather than as CSV on sock.
+    bool udp = false;
+    sockaddr_in udp_addr = {};
+    telemetry_policy policy = telemetry_policy::DROP;
+    uint32_t decimation = 1;
+    /// Records offered to this subscriber since it subscribed, for decimation.
+    uint32_t offered = 0;
+    uint32_t sent = 0;
+    uint32_t dropped = 0;
+    uint32_t consecutive_drops = 0;
+};
+
+static telemetry_subscriber subscribers[CONFIG_GNC_TELEMETRY_MAX_SUBSCRIBERS];
+static int num_subscribers = 0;
+/// Held while sending, so a subscriber can't be closed out from under a send.
+K_MUTEX_DEFINE(subscribers_lock);
+
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+/// Shared by every UDP subscriber; datagrams are addressed per send.
+static int udp_sock = -1;
+/// Counts frames rather than datagrams, so every subscriber's copy of a frame has the same number.
+static uint32_t udp_sequence = 0;
+static uint32_t udp_send_failures = 0;
+#endif
+
+static void remove_subscriber(int index) {
+    telemetry_subscriber &sub = subscribers[index];
+    LOG_INF("Unsubscribed socket %d: %u records sent, %u dropped", sub.sock, sub.sent, sub.dropped);
+    subscribers[index] = subscribers[num_subscribers - 1];
+    subscribers[num_subscribers - 1] = telemetry_subscriber{};
+    num_subscribers -= 1;
+}
+
+/// Adds or replaces the subscription owned by sub.sock. Must hold subscribers_lock.
+static int add_subscriber(const telemetry_subscriber &sub) {
+    int index = 0;
+    while (index < num_subscribers && subscribers[index].sock != sub.sock) {
+        ++index;
+    }
+    if (index == num_subscribers) {
+        if (num_subscribers == CONFIG_GNC_TELEMETRY_MAX_SUBSCRIBERS) {
+            LOG_ERR("Too many telemetry subscribers");
+            return -ENOMEM;
+        }
+        num_subscribers += 1;
+    }
+    subscribers[index] = sub;
+    return 0;
+}
+
+/// Opens the UDP telemetry socket and subscribes the configured multicast group, if any. Does nothing without
+/// CONFIG_GNC_TELEMETRY_UDP.
+int telemetry_init() {
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+    udp_sock = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udp_sock < 0) {
+        LOG_ERR("Failed to create UDP telemetry socket: errno %d", errno);
+        return 1;
+    }
+
+    constexpr std::string_view GROUP = CONFIG_GNC_TELEMETRY_UDP_GROUP;
+    if (!GROUP.empty()) {
+        telemetry_subscriber group = {
+                .sock = -1,
+                .udp = true,
+                .udp_addr = {
+                        .sin_family = AF_INET,
+                        .sin_port = htons(CONFIG_GNC_TELEMETRY_UDP_PORT),
+                },
+        };
+        if (zsock_inet_pton(AF_INET, CONFIG_GNC_TELEMETRY_UDP_GROUP, &group.udp_addr.sin_addr) != 1) {
+            LOG_ERR("Invalid telemetry group address: %s", CONFIG_GNC_TELEMETRY_UDP_GROUP);
+            return 1;
+        }
+        k_mutex_lock(&subscribers_lock, K_FOREVER);
+        int err = add_subscriber(group);
+        k_mutex_unlock(&subscribers_lock);
+        if (err) {
+            return 1;
+        }
+        LOG_INF("Sending telemetry to %s:%d", CONFIG_GNC_TELEMETRY_UDP_GROUP, CONFIG_GNC_TELEMETRY_UDP_PORT);
+    }
+#endif
+    return 0;
+}
+
+/// Subscribes sock to CSV records over its own connection, or updates its policy if it's already subscribed.
+/// decimation is only used with telemetry_policy::DECIMATE.
+int telemetry_subscribe(int sock, telemetry_policy policy, int decimation) {
+    if (policy == telemetry_policy::DECIMATE && decimation < 1) {
+        LOG_ERR("Invalid decimation: %d", decimation);
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&subscribers_lock, K_FOREVER);
+    int err = add_subscriber(telemetry_subscriber{
+            .sock = sock,
+            .policy = policy,
+            .decimation = policy == telemetry_policy::DECIMATE ? static_cast<uint32_t>(decimation) : 1,
+    });
+    k_mutex_unlock(&subscribers_lock);
+    return err;
+}
+
+/// Subscribes the peer of sock to datagrams sent to the given UDP port. The subscription is still owned by sock, and
+/// ends when it unsubscribes or disconnects.
+int telemetry_subscribe_udp(int sock, uint16_t port) {
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+    if (udp_sock < 0) {
+        return -ENOTSOCK;
+    }
+    telemetry_subscriber sub = {
+            .sock = sock,
+            .udp = true,
+    };
+    socklen_t addr_len = sizeof(sub.udp_addr);
+    if (zsock_getpeername(sock, reinterpret_cast<sockaddr *>(&sub.udp_addr), &addr_len) < 0) {
+        LOG_ERR("Failed to get peer address: errno %d", errno);
+        return -errno;
+    }
+    sub.udp_addr.sin_port = htons(port);
+
+    k_mutex_lock(&subscribers_lock, K_FOREVER);
+    int err = add_subscriber(sub);
+    k_mutex_unlock(&subscribers_lock);
+    return err;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+/// Removes the subscription owned by sock, if any. Must be called before a subscribed socket is closed.
+void telemetry_unsubscribe(int sock) {
+    k_mutex_lock(&subscribers_lock, K_FOREVER);
+    for (int i = 0; i < num_subscribers; ++i) {
+        if (subscribers[i].sock == sock) {
+            remove_subscriber(i);
+            break;
+        }
+    }
+    k_mutex_unlock(&subscribers_lock);
+}
+
+bool telemetry_is_subscribed(int sock) {
+    k_mutex_lock(&subscribers_lock, K_FOREVER);
+    bool found = std::any_of(subscribers, subscribers + num_subscribers,
+                             [sock](const telemetry_subscriber &sub) { return sub.sock == sock; });
+    k_mutex_unlock(&subscribers_lock);
+    return found;
+}
+
+int telemetry_num_subscribers() {
+    k_mutex_lock(&subscribers_lock, K_FOREVER);
+    int num = num_subscribers;
+    k_mutex_unlock(&subscribers_lock);
+    return num;
+}
+
+/// Records one send attempt on a subscriber. Returns false if the subscriber should be removed.
+static bool account_send(telemetry_subscriber &sub, bool delivered) {
+    if (delivered) {
+        sub.sent += 1;
+        sub.consecutive_drops = 0;
+        return true;
+    }
+    sub.dropped += 1;
+    sub.consecutive_drops += 1;
+    return sub.consecutive_drops < MAX_CONSECUTIVE_DROPS;
+}
+
+/// Sends everything in iov to a TCP subscriber, waiting at most STALL_TIMEOUT_MS at a time for it to make room. Used
+/// for framing and the rest of partly sent records, neither of which can be skipped, so a subscriber that stays full
+/// is removed rather than holding up the others. Returns false if the subscriber should be removed.
+static bool send_tcp_within_timeout(telemetry_subscriber &sub, iovec *iov, int iov_count) {
+    while (iov_count > 0) {
+        zsock_pollfd pollfd = {.fd = sub.sock, .events = ZSOCK_POLLOUT};
+        int ready = zsock_poll(&pollfd, 1, STALL_TIMEOUT_MS);
+        if (ready <= 0 || !(pollfd.revents & ZSOCK_POLLOUT)) {
+            LOG_WRN("Socket %d stalled on telemetry", sub.sock);
+            return false;
+        }
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov_count;
+        ssize_t ret = zsock_sendmsg(sub.sock, &msg, ZSOCK_MSG_DONTWAIT);
+        gnc_trace(gnc_trace_event::SOCKET_SEND, ret < 0 ? -errno : static_cast<int32_t>(ret));
+        if (ret < 0) {
+            if (errno == EAGAIN) {
+                continue;
+            }
+            LOG_WRN("Failed to send telemetry to socket %d: errno %d", sub.sock, errno);
+            return false;
+        }
+        iov_advance(iov, iov_count, static_cast<size_t>(ret));
+    }
+    return true;
+}
+
+/// Offers one CSV record to a TCP subscriber without blocking on it. Returns false if the subscriber should be removed.
+static bool offer_tcp(telemetry_subscriber &sub, const char *buf, int len) {
+    ssize_t ret = zsock_send(sub.sock, buf, len, ZSOCK_MSG_DONTWAIT);
+    gnc_trace(gnc_trace_event::SOCKET_SEND, ret < 0 ? -errno : static_cast<int32_t>(ret));
+    if (ret < 0) {
+        if (errno != EAGAIN) {
+            LOG_WRN("Failed to send telemetry to socket %d: errno %d", sub.sock, errno);
+            return false;
+        }
+        return account_send(sub, false);
+    }
+    // A partly sent record has to be finished, or the rest of the stream would be garbage.
+    if (ret < len) {
+        iovec iov = {.iov_base = const_cast<char *>(buf + ret), .iov_len = static_cast<size_t>(len - ret)};
+        if (!send_tcp_within_timeout(sub, &iov, 1)) {
+            return false;
+        }
+    }
+    return account_send(sub, true);
+}
+
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+/// Stamps the next sequence number and the current time onto a datagram header. Must hold subscribers_lock.
+static void stamp_header(telemetry_datagram_header &header, telemetry_kind kind) {
+    header = {
+            .magic = TELEMETRY_MAGIC,
+            .version = TELEMETRY_VERSION,
+            .kind = kind,
+            .sequence = udp_sequence++,
+            .device_time_ns = k_cyc_to_ns_floor64(k_cycle_get_64()),
+            .send_failures = udp_send_failures,
+    };
+}
+
+/// Sends a datagram of the header and, if given, the sample, without blocking or copying either into a combined
+/// buffer. A datagram that can't be sent is lost, and counted.
+static bool offer_udp(telemetry_subscriber &sub, const telemetry_datagram_header &header,
+                      const telemetry_sample *sample) {
+    // sendmsg doesn't write through the iovecs, they just aren't const.
+    iovec iov[] = {
+            {.iov_base = const_cast<telemetry_datagram_header *>(&header), .iov_len = sizeof(header)},
+            {.iov_base = const_cast<telemetry_sample *>(sample), .iov_len = sizeof(*sample)},
+    };
+    msghdr msg = {};
+    msg.msg_name = &sub.udp_addr;
+    msg.msg_namelen = sizeof(sub.udp_addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = sample ? 2 : 1;
+    ssize_t ret = zsock_sendmsg(udp_sock, &msg, ZSOCK_MSG_DONTWAIT);
+    gnc_trace(gnc_trace_event::SOCKET_SEND, ret < 0 ? -errno : static_cast<int32_t>(ret));
+    if (ret < 0) {
+        udp_send_failures += 1;
+    }
+    // Nothing on the other end acknowledges datagrams, so a UDP subscriber is only ever removed by its owner.
+    account_send(sub, ret >= 0);
+    return true;
+}
+#endif
+
+/// Sends stream framing to every subscriber: the given text pieces, in order, to TCP subscribers and a bare header of
+/// the given kind to UDP subscribers. Unlike records, framing must not be dropped, so a TCP subscriber that can't take
+/// it in time is unsubscribed instead.
+static void broadcast_framing([[maybe_unused]] telemetry_kind kind, std::span<const std::string_view> text) {
+    k_mutex_lock(&subscribers_lock, K_FOREVER);
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+    telemetry_datagram_header header;
+    stamp_header(header, kind);
+#endif
+    for (int i = 0; i < num_subscribers;) {
+        telemetry_subscriber &sub = subscribers[i];
+        bool keep = true;
+        if (sub.udp) {
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+            keep = offer_udp(sub, header, nullptr);
+#endif
+        } else {
+            // Rebuilt per subscriber, since sending consumes them.
+            std::array<iovec, 2> iov;
+            int iov_count = std::min(std::ssize(text), std::ssize(iov));
+            for (int j = 0; j < iov_count; ++j) {
+                iov[j] = {.iov_base = const_cast<char *>(text[j].data()), .iov_len = text[j].size()};
+            }
+            keep = send_tcp_within_timeout(sub, iov.data(), iov_count);
+        }
+        if (keep) {
+            ++i;
+        } else {
+            remove_subscriber(i);
+        }
+    }
+    k_mutex_unlock(&subscribers_lock);
+}
+
+/// Marks the start of a sequence for every subscriber.
+void telemetry_begin_sequence() {
+    constexpr std::array TEXT = {TELEMETRY_SEQ_START_MARKER, TELEMETRY_CSV_HEADER};
+    broadcast_framing(telemetry_kind::SEQUENCE_START, TEXT);
+}
+
+/// Marks the end of a sequence for every subscriber.
+void telemetry_end_sequence() {
+    constexpr std::array TEXT = {TELEMETRY_SEQ_END_MARKER};
+    broadcast_framing(telemetry_kind::SEQUENCE_END, TEXT);
+}
+
+/// Marks the start of a live stream for every subscriber. Its records have the same format as a sequence's.
+void telemetry_begin_stream() {
+    constexpr std::array TEXT = {TELEMETRY_STREAM_START_MARKER, TELEMETRY_CSV_HEADER};
+    broadcast_framing(telemetry_kind::STREAM_START, TEXT);
+}
+
+/// Marks the end of a live stream for every subscriber.
+void telemetry_end_stream() {
+    constexpr std::array TEXT = {TELEMETRY_STREAM_END_MARKER};
+    broadcast_framing(telemetry_kind::STREAM_END, TEXT);
+}
+
+/// Formats a sample as one CSV row, newline included, truncating it to fit in size bytes with the null byte. Returns
+/// the length written, not counting the null byte.
+int telemetry_encode_csv(const telemetry_sample &sample, char *buf, int size) {
+    int would_write = snprintfcb(buf, size, "%.8f,%d,%.8f,%.8f,%.8f,%.8f,%llu,%.8f,%.8f,%.8f,%.8f\n",
+                                 static_cast<double>(sample.time),
+                                 sample.queue_size,
+                                 static_cast<double>(sample.motor_target),
+                                 static_cast<double>(sample.motor_pos),
+                                 static_cast<double>(sample.motor_velocity),
+                                 static_cast<double>(sample.motor_acceleration),
+                                 sample.motor_nsec_per_pulse,
+                                 static_cast<double>(sample.pt202),
+                                 static_cast<double>(sample.pt203), static_cast<double>(sample.ptf401),
+                                 static_cast<double>(sample.pressure_target));
+    // snprintfcb's would_write excludes null byte, but max via size would include null byte.
+    return std::min(would_write, size - 1);
+}
+
+/// Sends one sample to every subscriber, subject to each one's policy. The sample is encoded at most once per
+/// transport, and a slow subscriber never holds up the others.
+void telemetry_publish(const telemetry_sample &sample) {
+    constexpr int MAX_DATA_LEN = 512;
+    char buf[MAX_DATA_LEN];
+    int len = -1;
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+    telemetry_datagram_header header;
+    bool stamped = false;
+#endif
+
+    k_mutex_lock(&subscribers_lock, K_FOREVER);
+    for (int i = 0; i < num_subscribers;) {
+        telemetry_subscriber &sub = subscribers[i];
+        sub.offered += 1;
+        bool keep = true;
+        if ((sub.offered - 1) % sub.decimation != 0) {
+            // Decimated away.
+        } else if (sub.udp) {
+#ifdef CONFIG_GNC_TELEMETRY_UDP
+            if (!stamped) {
+                stamp_header(header, telemetry_kind::SAMPLE);
+                stamped = true;
+            }
+            keep = offer_udp(sub, header, &sample);
+#endif
+        } else {
+            if (len < 0) {
+                len = telemetry_encode_csv(sample, buf, MAX_DATA_LEN);
+            }
+            keep = offer_tcp(sub, buf, len);
+        }
+        if (keep) {
+            ++i;
+        } else {
+            remove_subscriber(i);
+        }
+    }
+    k_mutex_unlock(&subscribers_lock);
+}
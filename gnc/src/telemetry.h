@@ -0,0 +1,39 @@
+#ifndef CLOVER_TELEMETRY_H
+#define CLOVER_TELEMETRY_H
+
+#include <cstdint>
+#include <gnc/telemetry_format.h>
+
+/// What to do with a subscriber whose socket can't take a record without blocking.
+enum class telemetry_policy {
+    /// Skip records until it catches up.
+    DROP,
+    /// Only send every Nth record, and skip any that would block.
+    DECIMATE,
+};
+
+int telemetry_init();
+
+int telemetry_subscribe(int sock, telemetry_policy policy, int decimation);
+
+int telemetry_subscribe_udp(int sock, uint16_t port);
+
+void telemetry_unsubscribe(int sock);
+
+bool telemetry_is_subscribed(int sock);
+
+int telemetry_num_subscribers();
+
+void telemetry_begin_sequence();
+
+int telemetry_encode_csv(const telemetry_sample &sample, char *buf, int size);
+
+void telemetry_publish(const telemetry_sample &sample);
+
+void telemetry_end_sequence();
+
+void telemetry_begin_stream();
+
+void telemetry_end_stream();
+
+#endif //CLOVER_TELEMETRY_H
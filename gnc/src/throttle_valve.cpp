@@ -7,58 +7,138 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/sys/util.h>
-#include <cmath>
 #include <algorithm>
 
+#include "gnc_trace.h"
+#include "log_limit.h"
+#include "persist.h"
+#ifdef CONFIG_GNC_PLANT_SIM
+#include "plant_sim.h"
+#endif
+
 static const struct gpio_dt_spec pul_gpio = GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), stepper_pul_gpios);
 static const struct gpio_dt_spec dir_gpio = GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), stepper_dir_gpios);
 
+#if DT_NODE_HAS_PROP(DT_PATH(zephyr_user), stepper_endstop_gpios)
+/// Open-side end-stop switch, active while the valve is against its hard stop.
+static const struct gpio_dt_spec endstop_gpio = GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), stepper_endstop_gpios);
+#endif
+
 /// Timer for delivering pulses to driver
 static const struct device *stepper_pulse_counter_dev = DEVICE_DT_GET(DT_ALIAS(stepper_pulse_counter));
 constexpr int COUNTER_CHANNEL = 0;
-volatile uint32_t pulse_counter_ticks = 0;
 
 LOG_MODULE_REGISTER(throttle_valve, CONFIG_LOG_DEFAULT_LEVEL);
 
-constexpr float MICROSTEPS = 8.0f;
-constexpr float GEARBOX_RATIO = 20.0f;
-constexpr float STEPS_PER_REVOLUTION = 200.0f;
-constexpr float DEG_PER_STEP = 360.0f / STEPS_PER_REVOLUTION / GEARBOX_RATIO / MICROSTEPS;
+/// Shortest time between repeats of an error in the pulse ISR or the per-tick path.
+constexpr uint32_t LOG_INTERVAL_MS = 1000;
 
-constexpr float MAX_VELOCITY = 225.0f; // In deg/s
-constexpr float MAX_ACCELERATION = 12000.0f; // In deg/s^2
+constexpr int32_t MICROSTEPS = 8;
+constexpr int32_t GEARBOX_RATIO = 20;
+constexpr int32_t STEPS_PER_REVOLUTION = 200;
+/// Microsteps per full revolution of the valve shaft.
+constexpr int32_t STEPS_PER_VALVE_REVOLUTION = STEPS_PER_REVOLUTION * GEARBOX_RATIO * MICROSTEPS;
+constexpr float DEG_PER_STEP = 360.0f / static_cast<float>(STEPS_PER_VALVE_REVOLUTION);
+constexpr float STEPS_PER_DEG = static_cast<float>(STEPS_PER_VALVE_REVOLUTION) / 360.0f;
+
+/// Converts degrees to the nearest whole microstep count. Single-precision only, so this is cheap on the M7's FPU.
+static constexpr int32_t deg_to_steps(float deg) {
+    return static_cast<int32_t>(deg * STEPS_PER_DEG + (deg >= 0.0f ? 0.5f : -0.5f));
+}
+
+/// Rate at which throttle_valve_move is expected to be called.
+constexpr int32_t CONTROL_HZ = 1000;
+
+constexpr int32_t MAX_VELOCITY = deg_to_steps(225.0f); // In steps/s
+constexpr int32_t MAX_ACCELERATION = deg_to_steps(12000.0f); // In steps/s^2
+/// Largest velocity change allowed within a single control tick, in steps/s.
+constexpr int32_t MAX_VELOCITY_DELTA = MAX_ACCELERATION / CONTROL_HZ;
+static_assert(MAX_VELOCITY_DELTA > 0, "Acceleration limit is too small to ever change velocity");
+
+/// Homing drives into the open-side hard stop, which defines this position.
+constexpr int32_t HOME_STEPS = deg_to_steps(90.0f);
+constexpr int32_t HOMING_FAST_VELOCITY = deg_to_steps(90.0f); // In steps/s
+constexpr int32_t HOMING_SLOW_VELOCITY = deg_to_steps(5.0f); // In steps/s
+constexpr int32_t HOMING_BACKOFF_VELOCITY = deg_to_steps(20.0f); // In steps/s
+constexpr int32_t HOMING_BACKOFF = deg_to_steps(3.0f);
+/// Give up looking for the end-stop after travelling this far, something is wrong.
+constexpr int32_t HOMING_MAX_TRAVEL = deg_to_steps(120.0f);
+
+#if defined(CONFIG_THROTTLE_VALVE_SIM_ENDSTOP) || defined(CONFIG_GNC_PLANT_SIM) || \
+    DT_NODE_HAS_PROP(DT_PATH(zephyr_user), stepper_endstop_gpios)
+constexpr bool HAS_ENDSTOP = true;
+#else
+constexpr bool HAS_ENDSTOP = false;
+#endif
+
+#ifdef CONFIG_THROTTLE_VALVE_SIM_ENDSTOP
+/// Steps travelled by the simulated valve since power-on. Unlike `steps`, this is never re-zeroed, and stops increasing
+/// once the valve is against the hard stop, just as a real stalled stepper would.
+static volatile int32_t sim_steps = 0;
+constexpr int32_t SIM_ENDSTOP_STEPS = deg_to_steps(CONFIG_THROTTLE_VALVE_SIM_ENDSTOP_DEG);
+#endif
 
 
 enum MotorState {
     STOPPED,
     RUNNING,
+    HOMING,
 };
 static MotorState state = STOPPED;
 
-volatile static int steps = 0;
-static float velocity = 0;
-static float acceleration = 0;
+volatile static int32_t steps = 0;
+/// Levels last driven onto PUL and DIR. Tracked here rather than read back from the pins, since not every GPIO driver
+/// reads back an output, gpio_emul among them.
+volatile static bool pul_level = false;
+volatile static bool dir_level = false;
+/// Position last commanded, in microsteps. Follows the valve while it is stopped, so there is never a stale target.
+volatile static int32_t target = 0;
+volatile static int32_t velocity = 0; // In steps/s
+static int32_t acceleration = 0; // In steps/s^2
 static volatile uint64_t last_time = 0;
 static volatile uint64_t true_interval = 0;
 K_MUTEX_DEFINE(motor_lock);
 
+/// Counter frequency and top value, cached at init so the control loop never has to ask the driver.
+static uint32_t pulse_counter_freq = 0;
+static uint32_t pulse_counter_top = 0;
+
+/// Interval between pulse alarms, in counter ticks, as the exact fraction whole + rem / den. The pulse ISR carries the
+/// fractional part forward in pulse_ticks_error so the average pulse period has no rounding drift.
+static volatile uint32_t pulse_ticks_whole = 0;
+static volatile uint32_t pulse_ticks_rem = 0;
+static volatile uint32_t pulse_ticks_den = 1;
+static uint32_t pulse_ticks_error = 0;
+
+/// Ticks until the next pulse alarm, accumulating the fractional remainder.
+static uint32_t next_pulse_ticks() {
+    uint32_t ticks = pulse_ticks_whole;
+    pulse_ticks_error += pulse_ticks_rem;
+    if (pulse_ticks_error >= pulse_ticks_den) {
+        pulse_ticks_error -= pulse_ticks_den;
+        ticks += 1;
+    }
+    return ticks;
+}
+
 
 /// Directly controls signal to controller, each rising edge on PUL is one step.
 static void pulse(const struct device *, uint8_t, uint32_t, void *) {
+    gnc_trace(gnc_trace_event::PULSE, steps);
     // Schedule next pulse
     int err = counter_cancel_channel_alarm(stepper_pulse_counter_dev, COUNTER_CHANNEL);
     if (err) {
-        LOG_ERR("Failed to cancel current stepper pulse counter channel alarm: err %d", err);
+        LOG_ERR_LIMITED(LOG_INTERVAL_MS, "Failed to cancel current stepper pulse counter channel alarm: err %d", err);
     }
     const counter_alarm_cfg pulse_counter_cfg = {
             .callback = pulse,
-            .ticks = pulse_counter_ticks,
+            .ticks = next_pulse_ticks(),
             .user_data = nullptr,
             .flags = 0
     };
     err = counter_set_channel_alarm(stepper_pulse_counter_dev, COUNTER_CHANNEL, &pulse_counter_cfg);
     if (err) {
-        LOG_ERR("Failed to set counter top: err %d", err);
+        LOG_ERR_LIMITED(LOG_INTERVAL_MS, "Failed to set counter top: err %d", err);
     }
 
     uint64_t now = k_cycle_get_64();
@@ -68,20 +148,33 @@ static void pulse(const struct device *, uint8_t, uint32_t, void *) {
     // Switch direction, if we must.
     // gpio high -> flipped by converter to low -> more open.
     // pgio low -> flipped by converter to high -> more close.
-    if ((gpio_pin_get_dt(&dir_gpio) == 1 && velocity > 0) || (!gpio_pin_get_dt(&dir_gpio) && velocity < 0)) {
-        gpio_pin_toggle_dt(&dir_gpio);
+    if ((dir_level && velocity > 0) || (!dir_level && velocity < 0)) {
+        dir_level = !dir_level;
+        gpio_pin_set_dt(&dir_gpio, dir_level);
         // We need to wait a while after changing dir before for next pulses.
         return;
     }
     // high to low -> flipped by converter to low to high -> rising edge, count a step.
-    if (gpio_pin_get_dt(&pul_gpio)) {
-        if (gpio_pin_get_dt(&dir_gpio)) {
+    if (pul_level) {
+        if (dir_level) {
             steps -= 1;
+#ifdef CONFIG_THROTTLE_VALVE_SIM_ENDSTOP
+            sim_steps -= 1;
+#endif
         } else {
             steps += 1;
+#ifdef CONFIG_THROTTLE_VALVE_SIM_ENDSTOP
+            if (sim_steps < SIM_ENDSTOP_STEPS) {
+                sim_steps += 1;
+            }
+#endif
         }
     }
-    gpio_pin_toggle_dt(&pul_gpio);
+    pul_level = !pul_level;
+    gpio_pin_set_dt(&pul_gpio, pul_level);
+#ifdef CONFIG_GNC_PLANT_SIM
+    plant_sim_pulse();
+#endif
 }
 
 /// Initializes throttle valve driver.
@@ -95,60 +188,53 @@ int throttle_valve_init() {
 
     gpio_pin_configure_dt(&pul_gpio, GPIO_OUTPUT_INACTIVE);
     gpio_pin_configure_dt(&dir_gpio, GPIO_OUTPUT_INACTIVE);
+    pul_level = false;
+    dir_level = false;
+#if DT_NODE_HAS_PROP(DT_PATH(zephyr_user), stepper_endstop_gpios)
+    if (!gpio_is_ready_dt(&endstop_gpio)) {
+        LOG_ERR("End-stop GPIO device not ready");
+        return -ENODEV;
+    }
+    gpio_pin_configure_dt(&endstop_gpio, GPIO_INPUT);
+#endif
 
     if (!device_is_ready(stepper_pulse_counter_dev)) {
         LOG_ERR("Stepper timer device is not ready.");
         return 1;
     }
+    pulse_counter_freq = counter_get_frequency(stepper_pulse_counter_dev);
+    pulse_counter_top = counter_get_top_value(stepper_pulse_counter_dev);
 
     LOG_INF("Throttle valve initialized.");
 
     return 0;
 }
 
-int throttle_valve_start_calibrate() {
-    LOG_INF("Beginning calibration.");
-//
-//    int err = throttle_valve_move(105.0f, 30.0f);
-//    if (err) {
-//        LOG_ERR("Move failed during calibration: err %d", err);
-//        return err;
-//    }
-//    steps = static_cast<int>(90.0f / DEG_PER_STEP);
-//
-//    LOG_INF("Done initial movement. Backing off.");
-//    throttle_valve_move(-5.0f, 0.5f);
-//
-//    LOG_INF("Calibrated to fully open.");
-    return 0;
+/// Whether the valve is currently against its open-side hard stop.
+static bool endstop_triggered() {
+#if defined(CONFIG_THROTTLE_VALVE_SIM_ENDSTOP)
+    return sim_steps >= SIM_ENDSTOP_STEPS;
+#elif defined(CONFIG_GNC_PLANT_SIM)
+    return plant_sim_endstop_triggered();
+#elif DT_NODE_HAS_PROP(DT_PATH(zephyr_user), stepper_endstop_gpios)
+    return gpio_pin_get_dt(&endstop_gpio) == 1;
+#else
+    return false;
+#endif
 }
 
-/// Moves to a certain degree position within the specified time. Does not necessarily guarantee that this will happen
-/// as speed and acceleration limits will be enforced, but it is what we will target.
-void throttle_valve_move(float target_deg) {
-    constexpr float CONTROL_TIME = 0.001;
-
-    float target_velocity = (target_deg - throttle_valve_get_pos()) / CONTROL_TIME;
-
+/// Commands a velocity in steps/s for the next control tick, subject to acceleration and velocity limits.
+static void set_velocity(int64_t target_velocity) {
     // If target velocity would require excessive acceleration, clamp it.
-    float required_acceleration = (target_velocity - velocity) / CONTROL_TIME;
-    if (required_acceleration > MAX_ACCELERATION) {
-        target_velocity = velocity + CONTROL_TIME * MAX_ACCELERATION;
-    } else if (required_acceleration < -MAX_ACCELERATION) {
-        target_velocity = velocity - CONTROL_TIME * MAX_ACCELERATION;
-    }
+    target_velocity = std::clamp<int64_t>(target_velocity, velocity - MAX_VELOCITY_DELTA,
+                                          velocity + MAX_VELOCITY_DELTA);
 
     // Clamp velocity
-    target_velocity = std::clamp(target_velocity, -MAX_VELOCITY, MAX_VELOCITY);
-
-    // Based on velocity, calculate pulse interval. Must divide by two as each counter trigger
-    // only toggles pulse, so two triggers are needed for full step on rising edge.
-    auto usec_per_pulse = static_cast<uint64_t>(1e6 / static_cast<double>(std::abs(target_velocity)) *
-                                                static_cast<double>(DEG_PER_STEP) / 2.0);
+    auto new_velocity = static_cast<int32_t>(std::clamp<int64_t>(target_velocity, -MAX_VELOCITY, MAX_VELOCITY));
 
     // Set true values for acceleration and velocity.
-    acceleration = (target_velocity - velocity) / CONTROL_TIME;
-    velocity = target_velocity;
+    acceleration = (new_velocity - velocity) * CONTROL_HZ;
+    velocity = new_velocity;
 
     // Ensure timer is running
     counter_start(stepper_pulse_counter_dev);
@@ -156,47 +242,195 @@ void throttle_valve_move(float target_deg) {
     // Halt current pulse counter.
     int err = counter_cancel_channel_alarm(stepper_pulse_counter_dev, COUNTER_CHANNEL);
     if (err) {
-        LOG_ERR("Failed to cancel current stepper pulse counter channel alarm: err %d", err);
+        LOG_ERR_LIMITED(LOG_INTERVAL_MS, "Failed to cancel current stepper pulse counter channel alarm: err %d", err);
     }
 
-    // Set new ticks between each alarm
-    pulse_counter_ticks = std::min(counter_us_to_ticks(stepper_pulse_counter_dev, usec_per_pulse),
-                                   counter_get_top_value(stepper_pulse_counter_dev));
+    // Holding position, no pulses needed until the next tick says otherwise.
+    if (new_velocity == 0) {
+        return;
+    }
+
+    // Based on velocity, calculate pulse interval. Must divide by two as each counter trigger only toggles pulse, so
+    // two triggers are needed for full step on rising edge.
+    uint32_t den = 2 * static_cast<uint32_t>(new_velocity < 0 ? -new_velocity : new_velocity);
+    uint32_t whole = pulse_counter_freq / den;
+    uint32_t rem = pulse_counter_freq % den;
+    if (whole >= pulse_counter_top) {
+        whole = pulse_counter_top;
+        rem = 0;
+    }
+    pulse_ticks_whole = whole;
+    pulse_ticks_rem = rem;
+    pulse_ticks_den = den;
+    pulse_ticks_error = 0;
 
     // Kick off new counter
-    static counter_alarm_cfg pulse_counter_cfg = {
+    const counter_alarm_cfg pulse_counter_cfg = {
             .callback = pulse,
-            .ticks = pulse_counter_ticks,
+            .ticks = whole,
             .user_data = nullptr,
             .flags = 0
     };
     err = counter_set_channel_alarm(stepper_pulse_counter_dev, COUNTER_CHANNEL, &pulse_counter_cfg);
     if (err) {
-        LOG_ERR("Failed to set counter top: err %d", err);
+        LOG_ERR_LIMITED(LOG_INTERVAL_MS, "Failed to set counter top: err %d", err);
+    }
+}
+
+/// Immediately stops pulsing without changing motor state.
+static void halt() {
+    counter_stop(stepper_pulse_counter_dev);
+    acceleration = 0;
+    velocity = 0;
+}
+
+/// Drives toward the hard stop at a constant velocity until the end-stop trips. Each iteration waits on `tick`, which
+/// must be a running 1 ms periodic timer.
+static int home_seek(int32_t seek_velocity, k_timer *tick) {
+    int32_t start = steps;
+    while (!endstop_triggered()) {
+        if (steps - start > HOMING_MAX_TRAVEL) {
+            LOG_ERR("End-stop not found within %d steps of travel", HOMING_MAX_TRAVEL);
+            return -ETIMEDOUT;
+        }
+        set_velocity(seek_velocity);
+        k_timer_status_sync(tick);
+    }
+    halt();
+    return 0;
+}
+
+/// Backs off the hard stop by HOMING_BACKOFF steps and checks that the end-stop released.
+static int home_back_off(k_timer *tick) {
+    // Several times longer than the back-off should take, in case the motor isn't moving at all.
+    constexpr int MAX_TICKS = 5 * HOMING_BACKOFF * CONTROL_HZ / HOMING_BACKOFF_VELOCITY;
+    int32_t target = steps - HOMING_BACKOFF;
+    for (int i = 0; steps > target; ++i) {
+        if (i == MAX_TICKS) {
+            halt();
+            LOG_ERR("Timed out backing off end-stop");
+            return -ETIMEDOUT;
+        }
+        set_velocity(-HOMING_BACKOFF_VELOCITY);
+        k_timer_status_sync(tick);
+    }
+    halt();
+    if (endstop_triggered()) {
+        LOG_ERR("End-stop still active after backing off");
+        return -EIO;
+    }
+    return 0;
+}
+
+/// Two-pass homing: find the hard stop quickly, back off, then approach it again slowly for a precise origin.
+static int home(k_timer *tick) {
+    int err = 0;
+    // Already against the stop, so get clear of it first or the fast pass would end immediately.
+    if (endstop_triggered()) {
+        err = home_back_off(tick);
+        if (err) {
+            return err;
+        }
+    }
+
+    LOG_INF("Seeking end-stop.");
+    err = home_seek(HOMING_FAST_VELOCITY, tick);
+    if (err) {
+        return err;
+    }
+
+    LOG_INF("Found end-stop. Backing off.");
+    err = home_back_off(tick);
+    if (err) {
+        return err;
+    }
+
+    LOG_INF("Approaching end-stop slowly.");
+    err = home_seek(HOMING_SLOW_VELOCITY, tick);
+    if (err) {
+        return err;
     }
+    steps = HOME_STEPS;
 
+    LOG_INF("Origin set. Backing off.");
+    return home_back_off(tick);
+}
+
+/// Homes the valve against its open-side hard stop and sets the step origin so that the stop sits at 90 deg. Blocks
+/// until done, which takes a couple seconds.
+int throttle_valve_start_calibrate() {
+    if (!HAS_ENDSTOP) {
+        LOG_ERR("No end-stop available, cannot calibrate.");
+        return -ENOTSUP;
+    }
+
+    k_mutex_lock(&motor_lock, K_FOREVER);
+    if (state != MotorState::STOPPED) {
+        k_mutex_unlock(&motor_lock);
+        LOG_ERR("Cannot calibrate while motor is running.");
+        return 1;
+    }
+    state = HOMING;
+    k_mutex_unlock(&motor_lock);
+    persist_pause();
+
+    LOG_INF("Beginning calibration.");
+    k_timer tick;
+    k_timer_init(&tick, nullptr, nullptr);
+    k_timer_start(&tick, K_MSEC(1), K_MSEC(1));
+    int err = home(&tick);
+    k_timer_stop(&tick);
+    throttle_valve_stop();
+    persist_resume();
+
+    if (err) {
+        LOG_ERR("Calibration failed: err %d", err);
+        return err;
+    }
+    LOG_INF("Calibrated to fully open.");
+    return 0;
+}
+
+/// Moves to a certain degree position within the specified time. Does not necessarily guarantee that this will happen
+/// as speed and acceleration limits will be enforced, but it is what we will target.
+void throttle_valve_move(float target_deg) {
+    throttle_valve_move_steps(deg_to_steps(target_deg));
+}
+
+/// Same as throttle_valve_move, but targets an absolute microstep position. All math here is integer, in steps and
+/// counter ticks.
+void throttle_valve_move_steps(int32_t target_steps) {
+    // Homing owns the motor until it is done.
+    if (state == HOMING) {
+        return;
+    }
+
+    // Velocity that would land on the target by the next control tick.
+    target = target_steps;
+    set_velocity(static_cast<int64_t>(target_steps - steps) * CONTROL_HZ);
     state = RUNNING;
 }
 
 void throttle_valve_stop() {
     k_mutex_lock(&motor_lock, K_FOREVER);
-    counter_stop(stepper_pulse_counter_dev);
-    acceleration = 0;
-    velocity = 0;
+    halt();
     state = STOPPED;
+    target = steps;
     k_mutex_unlock(&motor_lock);
+    // The valve has come to rest somewhere new.
+    persist_save_later();
 }
 
 /// Get the current acceleration in deg/s^2. It is only updated per call to
 /// throttle_valve_move.
 float throttle_valve_get_acceleration() {
-    return acceleration;
+    return static_cast<float>(acceleration) * DEG_PER_STEP;
 }
 
 /// Get the current velocity in deg/s. It is only updated per call to
 /// throttle_valve_move.
 float throttle_valve_get_velocity() {
-    return velocity;
+    return static_cast<float>(velocity) * DEG_PER_STEP;
 }
 
 /// Get current degree position of motor in degrees.
@@ -204,31 +438,62 @@ float throttle_valve_get_pos() {
     return static_cast<float>(steps) * DEG_PER_STEP;
 }
 
+/// Get current position of motor in microsteps.
+int32_t throttle_valve_get_steps() {
+    return steps;
+}
+
+/// Get the position last commanded, in microsteps, or the current position while stopped.
+int32_t throttle_valve_get_target_steps() {
+    return target;
+}
+
+/// Converts an angle to the nearest microstep position.
+int32_t throttle_valve_deg_to_steps(float degrees) {
+    return deg_to_steps(degrees);
+}
+
+/// Fastest the valve moves, in deg/s.
+float throttle_valve_get_max_velocity() {
+    return static_cast<float>(MAX_VELOCITY) * DEG_PER_STEP;
+}
+
 /// Get interval between each call to pulse counter.
 uint64_t throttle_valve_get_nsec_per_pulse() {
     return k_cyc_to_ns_near64(true_interval);
 }
 
-int throttle_valve_set_open() {
+/// Whether the motor is stopped, rather than homing or following moves.
+bool throttle_valve_is_idle() {
+    return state == MotorState::STOPPED;
+}
+
+/// Declares the current position to be target_steps WITHOUT moving the valve.
+int throttle_valve_set_steps(int32_t target_steps) {
     k_mutex_lock(&motor_lock, K_FOREVER);
     if (state != MotorState::STOPPED) {
         k_mutex_unlock(&motor_lock);
-        LOG_ERR("Cannot reset to position open when motor is stopped.");
+        LOG_ERR("Cannot reset position while motor is running.");
         return 1;
     }
-    steps = static_cast<int>(90.0f / DEG_PER_STEP);
+    steps = target_steps;
+    target = target_steps;
     k_mutex_unlock(&motor_lock);
+    persist_save_later();
     return 0;
 }
 
+int throttle_valve_set_open() {
+    return throttle_valve_set_steps(deg_to_steps(90.0f));
+}
+
 int throttle_valve_set_closed() {
-    k_mutex_lock(&motor_lock, K_FOREVER);
-    if (state != MotorState::STOPPED) {
-        k_mutex_unlock(&motor_lock);
-        LOG_ERR("Cannot reset to position closed when motor is stopped.");
-        return 1;
-    }
-    steps = 0;
-    k_mutex_unlock(&motor_lock);
-    return 0;
+    return throttle_valve_set_steps(0);
+}
+
+#ifdef CONFIG_ZTEST
+/// Runs the body of the pulse ISR once, from thread context, so tests can time it.
+void throttle_valve_bench_pulse() {
+    pulse(stepper_pulse_counter_dev, COUNTER_CHANNEL, 0, nullptr);
 }
+#endif
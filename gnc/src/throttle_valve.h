@@ -9,6 +9,14 @@ int throttle_valve_start_calibrate();
 
 float throttle_valve_get_pos();
 
+int32_t throttle_valve_get_steps();
+
+int32_t throttle_valve_get_target_steps();
+
+int32_t throttle_valve_deg_to_steps(float degrees);
+
+float throttle_valve_get_max_velocity();
+
 float throttle_valve_get_velocity();
 
 float throttle_valve_get_acceleration();
@@ -17,10 +25,20 @@ uint64_t throttle_valve_get_nsec_per_pulse();
 
 void throttle_valve_move(float degrees);
 
+void throttle_valve_move_steps(int32_t target_steps);
+
 void throttle_valve_stop();
 
 int throttle_valve_set_open();
 
 int throttle_valve_set_closed();
 
+int throttle_valve_set_steps(int32_t target_steps);
+
+bool throttle_valve_is_idle();
+
+#ifdef CONFIG_ZTEST
+void throttle_valve_bench_pulse();
+#endif
+
 #endif //CLOVER_THROTTLEVALVE_H
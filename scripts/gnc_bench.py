@@ -0,0 +1,193 @@
+"""
+Latency and throughput benchmark for the GNC command server.
+
+Runs against real hardware or against the firmware built for native_sim, where the server listens on the host's
+network stack:
+
+    west build -b native_sim gnc && ./build/zephyr/zephyr.exe &
+    python scripts/gnc_bench.py --host 127.0.0.1
+
+Measures:
+  - text command round trips (ping#), and binary RPC round trips (PING), as percentiles
+  - dstart# to first telemetry row latency
+  - sustained telemetry row rate, from a live stream at the requested rate
+
+The device timestamp echoed in each ping reply gives the offset between the device and host clocks, for lining up
+device logs with host measurements.
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+PORT = 19690
+
+RPC_MAGIC = bytes([0xC1, 0x0B, 0x52, 0x01])
+RPC_HEADER = struct.Struct("<HHIi")
+RPC_PING = 1
+
+
+def percentile(sorted_values, p):
+    """Nearest-rank percentile of an already sorted list."""
+    if not sorted_values:
+        return float("nan")
+    rank = max(0, min(len(sorted_values) - 1, round(p / 100 * len(sorted_values)) - 1))
+    return sorted_values[rank]
+
+
+def report(name, samples_s):
+    samples = sorted(samples_s)
+    print(f"{name}: n={len(samples)}"
+          f" p50={percentile(samples, 50) * 1e6:.0f}us"
+          f" p90={percentile(samples, 90) * 1e6:.0f}us"
+          f" p99={percentile(samples, 99) * 1e6:.0f}us"
+          f" max={samples[-1] * 1e6:.0f}us")
+
+
+class LineReader:
+    """Reads newline-terminated replies from a text connection."""
+
+    def __init__(self, sock):
+        self.sock = sock
+        self.buf = b""
+
+    def line(self):
+        while b"\n" not in self.buf:
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            self.buf += chunk
+        line, self.buf = self.buf.split(b"\n", 1)
+        return line.decode(errors="replace")
+
+
+def connect(host):
+    sock = socket.create_connection((host, PORT))
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    return sock
+
+
+def bench_text_ping(host, count):
+    """Round trips of ping#, with the device clock offset estimated from the fastest round trip."""
+    with connect(host) as sock:
+        reader = LineReader(sock)
+        rtts = []
+        best = None
+        for _ in range(count):
+            sent = time.perf_counter()
+            sock.sendall(b"ping#")
+            line = reader.line()
+            received = time.perf_counter()
+            device_s = int(line.split()[1]) / 1e9
+            rtt = received - sent
+            rtts.append(rtt)
+            # The fastest round trip bounds the offset most tightly.
+            if best is None or rtt < best[0]:
+                best = (rtt, device_s - (sent + rtt / 2))
+        report("text ping round trip", rtts)
+        return best[1]
+
+
+def bench_rpc_ping(host, count):
+    """Round trips of the binary PING request, sent one at a time."""
+    with connect(host) as sock:
+        sock.sendall(RPC_MAGIC)
+        echoed = b""
+        while len(echoed) < len(RPC_MAGIC):
+            echoed += sock.recv(len(RPC_MAGIC) - len(echoed))
+        if echoed != RPC_MAGIC:
+            raise ConnectionError("server did not echo the RPC magic")
+
+        rtts = []
+        buf = b""
+        for request_id in range(count):
+            sent = time.perf_counter()
+            sock.sendall(RPC_HEADER.pack(0, RPC_PING, request_id, 0))
+            while len(buf) < RPC_HEADER.size + 8:
+                buf += sock.recv(4096)
+            length, _, reply_id, status = RPC_HEADER.unpack_from(buf)
+            buf = buf[RPC_HEADER.size + length:]
+            rtts.append(time.perf_counter() - sent)
+            if reply_id != request_id or status != 0:
+                raise RuntimeError(f"bad PING reply: id {reply_id}, status {status}")
+        report("rpc ping round trip", rtts)
+
+
+def bench_first_row(host, runs):
+    """Time from sending dstart# to receiving the first row of sequence data. Each sequence holds the valve where it
+    is, so this is safe to run with hardware attached."""
+    latencies = []
+    with connect(host) as sock:
+        reader = LineReader(sock)
+        sock.sendall(b"getpos#")
+        pos = reader.line().split()[2]
+        for _ in range(runs):
+            sock.sendall(f"seq10;{pos},{pos}#".encode())
+            reader.line()
+            sent = time.perf_counter()
+            sock.sendall(b"dstart#")
+            first = None
+            while True:
+                line = reader.line()
+                if line.startswith(">>>>SEQ END"):
+                    break
+                if line.startswith("Failed"):
+                    raise RuntimeError(line)
+                if first is None and line and line[0].isdigit():
+                    first = time.perf_counter()
+            if first is None:
+                raise RuntimeError("sequence produced no rows")
+            latencies.append(first - sent)
+        sock.sendall(b"unlisten#")
+    report("dstart# to first row", latencies)
+
+
+def bench_stream(host, rate_hz, duration_s):
+    """Sustained row rate of a live stream, and rows lost on the device, judged by gaps in the device timestamps."""
+    with connect(host) as sock:
+        reader = LineReader(sock)
+        sock.sendall(f"stream{rate_hz}#".encode())
+        while not reader.line().startswith(">>>>STREAM START"):
+            pass
+        reader.line()  # CSV header
+
+        rows = 0
+        gaps = 0
+        last_time = None
+        period = 1 / rate_hz
+        start = time.perf_counter()
+        while time.perf_counter() - start < duration_s:
+            fields = reader.line().split(",")
+            device_time = float(fields[0])
+            if last_time is not None and device_time - last_time > 1.5 * period:
+                gaps += round((device_time - last_time) / period) - 1
+            last_time = device_time
+            rows += 1
+        elapsed = time.perf_counter() - start
+
+        sock.sendall(b"stopstream#")
+        while not reader.line().startswith(">>>>STREAM END"):
+            pass
+        sock.sendall(b"unlisten#")
+    print(f"stream at {rate_hz} Hz: {rows / elapsed:.0f} rows/s sustained over {elapsed:.1f}s, {gaps} rows missing")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--pings", type=int, default=1000)
+    parser.add_argument("--starts", type=int, default=20)
+    parser.add_argument("--rate", type=int, default=1000, help="stream rate in Hz, 1 to 1000")
+    parser.add_argument("--duration", type=float, default=10.0, help="seconds to stream for")
+    args = parser.parse_args()
+
+    offset_s = bench_text_ping(args.host, args.pings)
+    print(f"device clock leads host perf_counter by {offset_s:.6f}s")
+    bench_rpc_ping(args.host, args.pings)
+    bench_first_row(args.host, args.starts)
+    bench_stream(args.host, args.rate, args.duration)
+
+
+if __name__ == "__main__":
+    main()
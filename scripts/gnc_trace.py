@@ -0,0 +1,75 @@
+"""
+Downloads a timeline from firmware built with tracing.conf, as a CTF trace that babeltrace2 or Trace Compass can open.
+Works the same against hardware and against native_sim.
+
+    python scripts/gnc_trace.py start          # begin recording, discarding the last timeline
+    ... run a sequence ...
+    python scripts/gnc_trace.py dump trace/    # writes trace/metadata and trace/channel0_0
+    babeltrace2 trace/
+"""
+
+import argparse
+import os
+import socket
+
+PORT = 19690
+
+
+def read_exactly(sock, buf, n):
+    """Reads until buf holds at least n bytes, and splits them off."""
+    while len(buf) < n:
+        chunk = sock.recv(65536)
+        if not chunk:
+            raise ConnectionError("server closed the connection")
+        buf += chunk
+    return buf[:n], buf[n:]
+
+
+def command(host, text):
+    with socket.create_connection((host, PORT)) as sock:
+        sock.sendall(text.encode())
+        print(sock.recv(4096).decode(errors="replace").strip())
+
+
+def dump(host, out_dir):
+    with socket.create_connection((host, PORT)) as sock:
+        sock.sendall(b"tracedump#")
+        buf = b""
+        while b"\n" not in buf:
+            chunk = sock.recv(4096)
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            buf += chunk
+        line, buf = buf.split(b"\n", 1)
+        fields = line.decode(errors="replace").split()
+        if len(fields) != 3 or fields[0] != "trace":
+            raise RuntimeError(line.decode(errors="replace"))
+
+        metadata, buf = read_exactly(sock, buf, int(fields[1]))
+        stream, _ = read_exactly(sock, buf, int(fields[2]))
+
+    os.makedirs(out_dir, exist_ok=True)
+    with open(os.path.join(out_dir, "metadata"), "wb") as f:
+        f.write(metadata)
+    with open(os.path.join(out_dir, "channel0_0"), "wb") as f:
+        f.write(stream)
+    print(f"Wrote {len(stream)} bytes of events to {out_dir}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="192.168.0.150")
+    parser.add_argument("action", choices=["start", "stop", "dump"])
+    parser.add_argument("out_dir", nargs="?", default="trace")
+    args = parser.parse_args()
+
+    if args.action == "start":
+        command(args.host, "tracestart#")
+    elif args.action == "stop":
+        command(args.host, "tracestop#")
+    else:
+        dump(args.host, args.out_dir)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,2 +1,41 @@
-import plotly.express as px
+"""
+Plots a telemetry capture after decoding it to binary columns with tools/telemetry:
+
+    telemetry_export capture.txt --columns capture/
+    python scripts/throttle_graph.py capture/ [--run N]
+"""
+
+import argparse
 import os
+
+import numpy as np
+import plotly.express as px
+
+DTYPES = {".f32": np.float32, ".u32": np.uint32, ".u64": np.uint64}
+
+
+def load_columns(path):
+    """Every column in the directory, by name."""
+    columns = {}
+    for file in os.listdir(path):
+        name, ext = os.path.splitext(file)
+        if ext in DTYPES:
+            columns[name] = np.fromfile(os.path.join(path, file), dtype=DTYPES[ext])
+    return columns
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("columns", help="directory written by telemetry_export --columns")
+    parser.add_argument("--run", type=int, default=0, help="which sequence or stream in the capture to plot")
+    args = parser.parse_args()
+
+    columns = load_columns(args.columns)
+    rows = columns["run"] == args.run
+    data = {name: column[rows] for name, column in columns.items()}
+    fig = px.line(data, x="time", y=["motor_target", "motor_pos", "pt202", "pt203", "ptf401", "pressure_target"])
+    fig.show()
+
+
+if __name__ == "__main__":
+    main()
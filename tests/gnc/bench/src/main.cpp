@@ -0,0 +1,155 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file gnc control loop benchmarks
+ *
+ * Times the functions on the 1 ms control path, and fails if any has grown past its budget in the Kconfig. Budgets of
+ * 0 are reported without being checked.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "pressure_control.h"
+#include "pts.h"
+#include "redline.h"
+#include "sequencer.h"
+#include "telemetry.h"
+#include "throttle_valve.h"
+
+/// Length of the benchmark sequence. Control iterations cycle through it.
+constexpr int SEQUENCE_MS = 100;
+
+/// Times CONFIG_GNC_BENCH_ITERATIONS calls to fn, and checks the median against budget, both in cycles.
+template <typename F>
+static void bench(const char *name, uint32_t budget, F &&fn) {
+    static std::array<uint32_t, CONFIG_GNC_BENCH_ITERATIONS> cycles;
+    for (int i = 0; i < std::ssize(cycles); ++i) {
+        uint32_t start = k_cycle_get_32();
+        fn(i);
+        cycles[i] = k_cycle_get_32() - start;
+    }
+    std::sort(cycles.begin(), cycles.end());
+    uint32_t median = cycles[cycles.size() / 2];
+    uint32_t p99 = cycles[cycles.size() * 99 / 100];
+
+    TC_PRINT("%s: median %u, p99 %u, max %u cycles, budget %u\n", name, median, p99, cycles.back(), budget);
+    if (budget != 0) {
+        zassert_true(median <= budget, "%s took %u cycles, over its budget of %u", name, median, budget);
+    }
+}
+
+ZTEST(gnc_bench, test_step_control_loop) {
+    // A budget past the tick couldn't catch the control loop overrunning it.
+    uint32_t cycles_per_tick = sys_clock_hw_cycles_per_sec() / 1000;
+    zassert_true(CONFIG_GNC_BENCH_BUDGET_CONTROL_LOOP < cycles_per_tick,
+                 "Control loop budget of %u cycles is over the %u cycle tick", CONFIG_GNC_BENCH_BUDGET_CONTROL_LOOP,
+                 cycles_per_tick);
+
+    const std::array<float, 2> bps = {0.0f, 90.0f};
+    zassert_ok(sequencer_prepare(SEQUENCE_MS, bps));
+
+    bench("step_control_loop", CONFIG_GNC_BENCH_BUDGET_CONTROL_LOOP, [](int i) {
+        sequencer_bench_control_iteration(1 + i % (SEQUENCE_MS - 1));
+    });
+}
+
+ZTEST(gnc_bench, test_throttle_valve_move) {
+    // Alternate targets, so every call changes the commanded velocity.
+    bench("throttle_valve_move", CONFIG_GNC_BENCH_BUDGET_VALVE_MOVE, [](int i) {
+        throttle_valve_move(i % 2 ? 45.0f : 44.0f);
+    });
+}
+
+ZTEST(gnc_bench, test_pts_sample) {
+    static pt_readings readings;
+    bench("pts_sample", CONFIG_GNC_BENCH_BUDGET_PTS_SAMPLE, [](int) {
+        pts_sample(readings);
+    });
+}
+
+ZTEST(gnc_bench, test_redline_check) {
+    // Every limit on, and wide enough never to trip, so each frame takes the whole path.
+    for (int i = 0; i < NUM_PTS; ++i) {
+        zassert_ok(redline_set_pt(i, pt_redline{.enabled = true, .min_psi = -1e6f, .max_psi = 1e6f,
+                                                .max_rate_psi_per_s = 1e9f}));
+    }
+    zassert_ok(redline_set_valve(valve_redline{.max_tracking_deg = 90.0f, .safe_deg = 0.0f}));
+    redline_arm();
+
+    static uint16_t frames[2][NUM_PTS];
+    for (int i = 0; i < NUM_PTS; ++i) {
+        frames[0][i] = static_cast<uint16_t>(1000 + i);
+        frames[1][i] = static_cast<uint16_t>(1010 + i);
+    }
+    bench("redline_check", CONFIG_GNC_BENCH_BUDGET_REDLINE_CHECK, [](int i) {
+        redline_check(frames[i % 2]);
+    });
+    redline_disarm();
+    zassert_false(redline_tripped(), "Tripped on limits that should never trip");
+}
+
+ZTEST(gnc_bench, test_pulse) {
+    // Moving, so the ISR has steps to count.
+    throttle_valve_move(45.0f);
+
+    bench("pulse", CONFIG_GNC_BENCH_BUDGET_PULSE, [](int) {
+        throttle_valve_bench_pulse();
+    });
+}
+
+ZTEST(gnc_bench, test_pressure_control_step) {
+    pressure_control_begin(pressure_gains{.kp = 0.05f, .ki = 1.0f, .kd = 0.001f}, 200.0f);
+    static volatile float command;
+
+    // Targets across the characteristic, so the feedforward walks different lengths of the table.
+    bench("pressure_control_step", CONFIG_GNC_BENCH_BUDGET_PRESSURE_CONTROL, [](int i) {
+        command = pressure_control_step(static_cast<float>(i % 400), 200.0f + static_cast<float>(i % 7), 40.0f);
+    });
+    pressure_control_end();
+    zassert_true(command >= 0.0f && command <= 90.0f, "Valve command out of range: %f", static_cast<double>(command));
+}
+
+ZTEST(gnc_bench, test_telemetry_encode) {
+    // Representative values, so every field prints at full width.
+    const telemetry_sample sample = {
+            .time = 12.345678f,
+            .queue_size = 3,
+            .motor_target = 45.123456f,
+            .motor_pos = 44.987654f,
+            .motor_velocity = -123.456789f,
+            .motor_acceleration = 11999.5f,
+            .motor_nsec_per_pulse = 2'777'777,
+            .pt202 = 512.25f,
+            .pt203 = 498.75f,
+            .ptf401 = 401.125f,
+            .pressure_target = 400.0f,
+    };
+    static char buf[512];
+    static volatile int len;
+
+    bench("telemetry_encode_csv", CONFIG_GNC_BENCH_BUDGET_TELEMETRY_ENCODE, [&sample](int) {
+        len = telemetry_encode_csv(sample, buf, sizeof(buf));
+    });
+    zassert_true(len > 0, "Encoded an empty row");
+}
+
+static void *gnc_bench_setup() {
+    zassert_ok(pts_init());
+    zassert_ok(throttle_valve_init());
+    zassert_ok(throttle_valve_set_closed());
+    return nullptr;
+}
+
+/// Leaves the valve stopped for the next benchmark, so no pulses are left running in the background.
+static void gnc_bench_after(void *) {
+    throttle_valve_stop();
+}
+
+ZTEST_SUITE(gnc_bench, nullptr, gnc_bench_setup, nullptr, gnc_bench_after, nullptr);
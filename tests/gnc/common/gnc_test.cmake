@@ -0,0 +1,19 @@
+# SPDX-License-Identifier: Apache-2.0
+#
+# Builds a gnc test suite from the app's own sources and board config, so the suites can't drift from the app or from
+# each other. Include before find_package(Zephyr), then call gnc_test_sources() once the app target exists.
+
+set(GNC_DIR ${CMAKE_CURRENT_LIST_DIR}/../../../gnc)
+
+list(APPEND EXTRA_CONF_FILE ${CMAKE_CURRENT_LIST_DIR}/gnc_test.conf)
+if(BOARD MATCHES "^native_sim")
+  # Same emulated pins, PTs, stepper timer and flash as the app on native_sim.
+  list(APPEND EXTRA_CONF_FILE ${GNC_DIR}/boards/native_sim.conf)
+  list(APPEND EXTRA_DTC_OVERLAY_FILE ${GNC_DIR}/boards/native_sim.overlay)
+endif()
+
+# Everything in gnc/src but the app's main, which ztest provides.
+macro(gnc_test_sources)
+  target_include_directories(app PRIVATE ${GNC_DIR}/include ${GNC_DIR}/src)
+  add_subdirectory(${GNC_DIR}/src ${CMAKE_BINARY_DIR}/gnc)
+endmacro()
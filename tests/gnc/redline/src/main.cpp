@@ -0,0 +1,167 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file gnc redline tests
+ *
+ * Feeds PT frames straight to the redline check, so each test controls exactly what the monitor sees. Acquisition
+ * isn't started, so as far as control ticks can tell, the ADC has stalled.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "pts.h"
+#include "redline.h"
+#include "throttle_valve.h"
+
+/// Any PT will do. Every PT is checked alike.
+constexpr int PT_INDEX = 1;
+/// What the PTs read when nothing is wrong, in psi.
+constexpr float NOMINAL_PSI = 300.0f;
+
+/// Checks n identical frames, with PT_INDEX reading psi and the rest nominal, under the default calibration.
+static void feed(float psi, int n) {
+    uint16_t frame[NUM_PTS];
+    for (int i = 0; i < NUM_PTS; ++i) {
+        frame[i] = static_cast<uint16_t>(NOMINAL_PSI / pt_configs[i].scale);
+    }
+    frame[PT_INDEX] = static_cast<uint16_t>(psi / pt_configs[PT_INDEX].scale);
+    for (int i = 0; i < n; ++i) {
+        redline_check(frame);
+    }
+}
+
+static void set_limits(float min_psi, float max_psi, float max_rate_psi_per_s) {
+    zassert_ok(redline_set_pt(PT_INDEX, pt_redline{.enabled = true, .min_psi = min_psi, .max_psi = max_psi,
+                                                   .max_rate_psi_per_s = max_rate_psi_per_s}));
+}
+
+ZTEST(gnc_redline, test_high) {
+    set_limits(0.0f, 500.0f, 0.0f);
+    redline_arm();
+
+    feed(NOMINAL_PSI, 20);
+    feed(600.0f, CONFIG_GNC_REDLINE_CONFIRM_FRAMES - 1);
+    zassert_false(redline_tripped(), "Tripped before the limit was confirmed");
+    feed(600.0f, 1);
+    zassert_true(redline_tripped());
+
+    redline_trip trip = redline_last_trip();
+    zassert_equal(trip.limit, redline_limit::HIGH);
+    zassert_equal(trip.pt, PT_INDEX);
+    zassert_within(trip.value, 600.0f, pt_configs[PT_INDEX].scale);
+}
+
+ZTEST(gnc_redline, test_low) {
+    set_limits(100.0f, 500.0f, 0.0f);
+    redline_arm();
+
+    feed(50.0f, CONFIG_GNC_REDLINE_CONFIRM_FRAMES);
+    zassert_true(redline_tripped());
+    zassert_equal(redline_last_trip().limit, redline_limit::LOW);
+}
+
+ZTEST(gnc_redline, test_spike_ignored) {
+    if (CONFIG_GNC_REDLINE_CONFIRM_FRAMES == 1) {
+        ztest_test_skip();
+    }
+    set_limits(0.0f, 500.0f, 0.0f);
+    redline_arm();
+
+    for (int i = 0; i < 10; ++i) {
+        feed(900.0f, CONFIG_GNC_REDLINE_CONFIRM_FRAMES - 1);
+        feed(NOMINAL_PSI, 1);
+    }
+    zassert_false(redline_tripped(), "Tripped on frames that were never over the limit long enough");
+}
+
+ZTEST(gnc_redline, test_rate) {
+    constexpr float MAX_RATE = 10000.0f;
+    constexpr float FRAME_S = CONFIG_GNC_PTS_INTERVAL_US / 1e6f;
+    set_limits(0.0f, 1000.0f, MAX_RATE);
+    redline_arm();
+
+    // A ramp at half the limit is fine.
+    float psi = NOMINAL_PSI;
+    for (int i = 0; i < 100; ++i) {
+        psi += MAX_RATE / 2.0f * FRAME_S;
+        feed(psi, 1);
+    }
+    zassert_false(redline_tripped(), "Tripped on a ramp within the rate limit");
+
+    // A step of 100 psi is 100000 psi/s over the millisecond the rate is measured across.
+    feed(psi + 100.0f, CONFIG_GNC_REDLINE_CONFIRM_FRAMES);
+    zassert_true(redline_tripped());
+    redline_trip trip = redline_last_trip();
+    zassert_equal(trip.limit, redline_limit::RATE);
+    zassert_true(trip.value > MAX_RATE, "Reported rate %f is within the limit", static_cast<double>(trip.value));
+}
+
+ZTEST(gnc_redline, test_disarmed) {
+    set_limits(0.0f, 500.0f, 0.0f);
+    redline_arm();
+    redline_disarm();
+
+    feed(900.0f, 10);
+    zassert_false(redline_tripped(), "Tripped while disarmed");
+}
+
+ZTEST(gnc_redline, test_tracking_aborts_to_safe) {
+    zassert_ok(throttle_valve_set_closed());
+    zassert_ok(redline_set_valve(valve_redline{.max_tracking_deg = 5.0f, .safe_deg = 10.0f}));
+    redline_arm();
+
+    // Far more than the valve can cover before the frames are checked.
+    throttle_valve_move(45.0f);
+    feed(NOMINAL_PSI, CONFIG_GNC_REDLINE_CONFIRM_FRAMES);
+    zassert_true(redline_tripped());
+    zassert_equal(redline_last_trip().limit, redline_limit::TRACKING);
+    zassert_equal(redline_last_trip().pt, -1);
+
+    // The abort runs in the system workqueue.
+    k_sleep(K_MSEC(10));
+    zassert_equal(throttle_valve_get_target_steps(), throttle_valve_deg_to_steps(10.0f),
+                  "Safe position wasn't commanded");
+}
+
+ZTEST(gnc_redline, test_acquisition_stalled) {
+    redline_arm();
+
+    for (int i = 0; i < CONFIG_GNC_REDLINE_STALE_TICKS - 1; ++i) {
+        redline_check_acquisition();
+    }
+    zassert_false(redline_tripped(), "Tripped before the stall was confirmed");
+    redline_check_acquisition();
+    zassert_true(redline_tripped());
+
+    redline_trip trip = redline_last_trip();
+    zassert_equal(trip.limit, redline_limit::ACQUISITION);
+    zassert_equal(trip.pt, -1);
+    zassert_equal(trip.value, static_cast<float>(CONFIG_GNC_REDLINE_STALE_TICKS));
+}
+
+ZTEST(gnc_redline, test_acquisition_disarmed) {
+    for (int i = 0; i < 2 * CONFIG_GNC_REDLINE_STALE_TICKS; ++i) {
+        redline_check_acquisition();
+    }
+    zassert_false(redline_tripped(), "Tripped while disarmed");
+}
+
+static void *gnc_redline_setup() {
+    zassert_ok(throttle_valve_init());
+    return nullptr;
+}
+
+/// Every test starts disarmed, with no limits.
+static void gnc_redline_before(void *) {
+    redline_disarm();
+    throttle_valve_stop();
+    for (int i = 0; i < NUM_PTS; ++i) {
+        zassert_ok(redline_set_pt(i, pt_redline{}));
+    }
+    zassert_ok(redline_set_valve(valve_redline{}));
+}
+
+ZTEST_SUITE(gnc_redline, nullptr, gnc_redline_setup, gnc_redline_before, nullptr, nullptr);
@@ -0,0 +1,143 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file gnc sequencer tests
+ *
+ * Runs uploaded profiles against the plant model, with telemetry going to one end of a socket pair so the tests can
+ * tell when a sequence has ended.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/ztest.h>
+
+#include "pressure_control.h"
+#include "pts.h"
+#include "redline.h"
+#include "sequencer.h"
+#include "telemetry.h"
+#include "throttle_valve.h"
+
+/// Where the valve is taken and held by the test profile, in deg.
+constexpr float HOLD_DEG = 5.0f;
+/// The test profile: to HOLD_DEG, well within the valve's speed, then holding there.
+constexpr profile_point PROFILE[] = {
+        {.duration_ms = 100, .target_deg = HOLD_DEG},
+        {.duration_ms = 100, .target_deg = HOLD_DEG},
+};
+constexpr int PROFILE_MS = 200;
+/// A point that would send the valve somewhere else entirely, if it were ever taken.
+constexpr profile_point STRAY[] = {{.duration_ms = 10, .target_deg = 45.0f}};
+
+/// Subscribed end, and the end the tests read telemetry from.
+static int telemetry_socks[2] = {-1, -1};
+
+static void upload_profile() {
+    zassert_ok(sequencer_profile_begin(std::ssize(PROFILE)));
+    zassert_ok(sequencer_profile_append(PROFILE));
+    zassert_ok(sequencer_profile_end());
+    zassert_equal(sequencer_get_duration_ms(), PROFILE_MS);
+}
+
+/// Reads telemetry until the SEQ END marker, failing if none arrives for a second.
+static void wait_for_sequence_end() {
+    constexpr std::string_view MARKER = TELEMETRY_SEQ_END_MARKER;
+    char buf[512];
+    int len = 0;
+    while (true) {
+        zsock_pollfd pollfd = {.fd = telemetry_socks[1], .events = ZSOCK_POLLIN};
+        zassert_equal(zsock_poll(&pollfd, 1, 1000), 1, "Sequence didn't end");
+        ssize_t ret = zsock_recv(telemetry_socks[1], buf + len, sizeof(buf) - len, 0);
+        zassert_true(ret > 0, "Failed to read telemetry: errno %d", errno);
+        len += static_cast<int>(ret);
+        if (std::string_view{buf, static_cast<size_t>(len)}.find(MARKER) != std::string_view::npos) {
+            return;
+        }
+        // Keep only what could be the start of a marker split across reads.
+        int keep = std::min(len, static_cast<int>(MARKER.size()) - 1);
+        memmove(buf, buf + len - keep, keep);
+        len = keep;
+    }
+}
+
+ZTEST(gnc_sequencer, test_append_without_upload) {
+    upload_profile();
+
+    zassert_not_ok(sequencer_profile_append(STRAY));
+    zassert_not_ok(sequencer_profile_end());
+    zassert_equal(sequencer_get_duration_ms(), PROFILE_MS, "Prepared profile changed");
+}
+
+ZTEST(gnc_sequencer, test_append_during_run) {
+    upload_profile();
+    zassert_ok(sequencer_start_trace());
+
+    zassert_not_ok(sequencer_profile_append(STRAY));
+    zassert_not_ok(sequencer_profile_end());
+    zassert_equal(sequencer_get_duration_ms(), PROFILE_MS, "Running profile changed");
+
+    // The run follows the profile it started with to the end.
+    wait_for_sequence_end();
+    zassert_within(throttle_valve_get_pos(), HOLD_DEG, 0.5f, "Valve ended at %f deg",
+                   static_cast<double>(throttle_valve_get_pos()));
+    zassert_equal(sequencer_get_duration_ms(), PROFILE_MS, "Profile changed after the run");
+}
+
+ZTEST(gnc_sequencer, test_invalid_point_abandons_upload) {
+    upload_profile();
+
+    const profile_point invalid[] = {{.duration_ms = 0, .target_deg = HOLD_DEG}};
+    zassert_ok(sequencer_profile_begin(1));
+    zassert_not_ok(sequencer_profile_append(invalid));
+    zassert_not_ok(sequencer_profile_end());
+    zassert_equal(sequencer_get_duration_ms(), 0, "Abandoned upload left a runnable profile");
+}
+
+ZTEST(gnc_sequencer, test_pressure_fails_safe_without_readings) {
+    constexpr float SAFE_DEG = 5.0f;
+    // A chamber pressure the plant reaches well short of full open.
+    constexpr profile_point PRESSURE_PROFILE[] = {
+            {.duration_ms = 100, .target_deg = 150.0f},
+            {.duration_ms = 900, .target_deg = 150.0f},
+    };
+    zassert_ok(redline_set_valve(valve_redline{.max_tracking_deg = 0.0f, .safe_deg = SAFE_DEG}));
+    zassert_ok(sequencer_profile_begin(std::ssize(PRESSURE_PROFILE)));
+    zassert_ok(sequencer_profile_append(PRESSURE_PROFILE));
+    zassert_ok(sequencer_profile_end());
+    zassert_ok(sequencer_set_pressure_control(pressure_gains{.kp = 0.05f, .ki = 4.0f, .kd = 0.0f}));
+    zassert_ok(sequencer_start_trace());
+
+    // The ADC dies mid-sequence. Acting on the missing chamber reading would open the valve wide.
+    k_msleep(200);
+    pts_fail_acquisition(true);
+    wait_for_sequence_end();
+    pts_fail_acquisition(false);
+
+    zassert_equal(redline_last_trip().limit, redline_limit::ACQUISITION, "Lost acquisition didn't trip");
+    zassert_within(throttle_valve_get_pos(), SAFE_DEG, 0.5f, "Valve ended at %f deg",
+                   static_cast<double>(throttle_valve_get_pos()));
+
+    // Sampling again restarts acquisition, for the other tests.
+    pt_readings readings;
+    pts_sample(readings);
+    uint32_t frames = pts_frame_count();
+    k_msleep(10);
+    zassert_not_equal(pts_frame_count(), frames, "Acquisition didn't restart");
+}
+
+static void *gnc_sequencer_setup() {
+    zassert_ok(pts_init());
+    zassert_ok(throttle_valve_init());
+    zassert_ok(throttle_valve_set_closed());
+    zassert_ok(zsock_socketpair(AF_UNIX, SOCK_STREAM, 0, telemetry_socks));
+    zassert_ok(telemetry_subscribe(telemetry_socks[0], telemetry_policy::DROP, 1));
+    return nullptr;
+}
+
+ZTEST_SUITE(gnc_sequencer, nullptr, gnc_sequencer_setup, nullptr, nullptr, nullptr);
@@ -0,0 +1,122 @@
+/*
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * @file gnc settings tests
+ *
+ * Round-trips PT calibration, the valve position and redlines through the settings subsystem, on native_sim's flash
+ * simulator.
+ */
+
+#include <iterator>
+
+#include <zephyr/kernel.h>
+#include <zephyr/ztest.h>
+
+#include "persist.h"
+#include "pressure_control.h"
+#include "pts.h"
+#include "redline.h"
+#include "throttle_valve.h"
+
+/// Any PT will do. Saving covers them all alike.
+constexpr int PT_INDEX = 1;
+
+/// Scrambles the RAM copies of everything saved, without scheduling a save of the scrambled values.
+static void forget() {
+    pt_configs[PT_INDEX].bias = 0.0f;
+    pt_configs[PT_INDEX].range = 1000.0f;
+    pt_configs[PT_INDEX].scale = 1.0f;
+}
+
+ZTEST(gnc_settings, test_round_trip) {
+    const valve_characteristic_point characteristic[] = {{0.0f, 5.0f}, {100.0f, 30.0f}, {300.0f, 80.0f}};
+    const valve_characteristic_point other[] = {{0.0f, 0.0f}, {1.0f, 1.0f}};
+
+    zassert_ok(pts_set_range(PT_INDEX, 2000.0f));
+    zassert_ok(pts_set_bias(PT_INDEX, -5.5f));
+    zassert_ok(throttle_valve_set_steps(1234));
+    zassert_ok(pressure_control_set_characteristic(characteristic));
+    zassert_ok(redline_set_pt(PT_INDEX, pt_redline{.enabled = true, .min_psi = 10.0f, .max_psi = 500.0f,
+                                                   .max_rate_psi_per_s = 1000.0f}));
+    zassert_ok(redline_set_valve(valve_redline{.max_tracking_deg = 5.0f, .safe_deg = 20.0f}));
+    zassert_ok(persist_save());
+
+    forget();
+    zassert_ok(throttle_valve_set_closed());
+    zassert_ok(pressure_control_set_characteristic(other));
+    zassert_ok(redline_set_pt(PT_INDEX, pt_redline{}));
+    zassert_ok(redline_set_valve(valve_redline{}));
+    zassert_ok(persist_load());
+
+    zassert_equal(pressure_control_get_characteristic().size(), std::size(characteristic));
+    zassert_equal(pressure_control_feedforward(200.0f), 55.0f);
+
+    zassert_equal(pt_configs[PT_INDEX].bias, -5.5f);
+    zassert_equal(pt_configs[PT_INDEX].range, 2000.0f);
+    zassert_equal(pt_configs[PT_INDEX].scale, 2000.0f / 4096.0f, "Scale wasn't rederived from the range");
+    zassert_equal(throttle_valve_get_steps(), 1234);
+
+    zassert_true(redline_get_pt(PT_INDEX).enabled);
+    zassert_equal(redline_get_pt(PT_INDEX).max_psi, 500.0f);
+    zassert_equal(redline_get_valve().safe_deg, 20.0f);
+}
+
+/// Waits out any save that earlier changes scheduled.
+static void settle() {
+    k_sleep(K_MSEC(CONFIG_GNC_SETTINGS_SAVE_DELAY_MS * 3));
+}
+
+ZTEST(gnc_settings, test_debounced_save) {
+    settle();
+    uint32_t saves = persist_debounced_saves();
+
+    // A burst of changes, of which only the last should land.
+    for (int i = 1; i <= 10; ++i) {
+        zassert_ok(pts_set_bias(PT_INDEX, static_cast<float>(i)));
+    }
+    k_sleep(K_MSEC(CONFIG_GNC_SETTINGS_SAVE_DELAY_MS / 2));
+    zassert_equal(persist_debounced_saves(), saves, "Saved before the changes settled");
+    settle();
+    zassert_equal(persist_debounced_saves(), saves + 1, "Burst of changes took %u saves",
+                  persist_debounced_saves() - saves);
+
+    forget();
+    zassert_ok(persist_load());
+    zassert_equal(pt_configs[PT_INDEX].bias, 10.0f);
+}
+
+ZTEST(gnc_settings, test_pause) {
+    zassert_ok(throttle_valve_set_steps(1234));
+    zassert_ok(persist_save());
+    settle();
+    uint32_t saves = persist_debounced_saves();
+
+    // As at the start of a sequence. The old position is gone, and nothing is saved until it's over.
+    persist_pause();
+    zassert_ok(throttle_valve_set_steps(0));
+    zassert_ok(persist_load());
+    zassert_equal(throttle_valve_get_steps(), 0, "Loaded a position saved before the valve moved");
+    zassert_ok(pts_set_bias(PT_INDEX, 20.0f));
+    settle();
+    zassert_equal(persist_debounced_saves(), saves, "Saved while paused");
+
+    persist_resume();
+    settle();
+    zassert_equal(persist_debounced_saves(), saves + 1, "Changes made while paused weren't saved");
+    forget();
+    zassert_ok(throttle_valve_set_steps(1));
+    zassert_ok(persist_load());
+    zassert_equal(pt_configs[PT_INDEX].bias, 20.0f);
+    zassert_equal(throttle_valve_get_steps(), 0);
+}
+
+static void *gnc_settings_setup() {
+    zassert_ok(pts_init());
+    zassert_ok(throttle_valve_init());
+    zassert_ok(persist_load());
+    return nullptr;
+}
+
+ZTEST_SUITE(gnc_settings, nullptr, gnc_settings_setup, nullptr, nullptr, nullptr);
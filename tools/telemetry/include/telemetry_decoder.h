@@ -0,0 +1,427 @@
+#ifndef CLOVER_TELEMETRY_DECODER_H
+#define CLOVER_TELEMETRY_DECODER_H
+
+/*
+ * Decodes gnc telemetry on the host, into one array per field of telemetry_sample. Header-only, and shares its wire
+ * formats with the firmware through gnc/telemetry_format.h.
+ *
+ * Captures of the TCP stream are fed in arbitrary chunks, as they come off a socket or a file. UDP datagrams are fed
+ * one at a time. Either way, decoding appends to a TelemetryColumns, which can then be written out as CSV or as one
+ * raw binary file per column, for numpy.fromfile or similar.
+ */
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <gnc/telemetry_format.h>
+
+enum class telemetry_run_kind {
+    SEQUENCE,
+    STREAM,
+};
+
+/// One sequence or live stream within a capture.
+struct TelemetryRun {
+    telemetry_run_kind kind;
+    /// Row of the run's first sample in the columns.
+    size_t first_row;
+    size_t num_rows;
+    /// Whether the run's end marker arrived. A capture cut short leaves its last run incomplete.
+    bool complete;
+};
+
+/// Decoded samples. Each field of telemetry_sample has a column of the same name, and row i of every column is the
+/// i-th sample decoded.
+struct TelemetryColumns {
+    std::vector<float> time;
+    std::vector<uint32_t> queue_size;
+    std::vector<float> motor_target;
+    std::vector<float> motor_pos;
+    std::vector<float> motor_velocity;
+    std::vector<float> motor_acceleration;
+    std::vector<uint64_t> motor_nsec_per_pulse;
+    std::vector<float> pt202;
+    std::vector<float> pt203;
+    std::vector<float> ptf401;
+    std::vector<float> pressure_target;
+    /// Index in runs of the run each row belongs to.
+    std::vector<uint32_t> run;
+
+    std::vector<TelemetryRun> runs;
+
+    [[nodiscard]] size_t size() const {
+        return time.size();
+    }
+
+    void reserve(size_t rows) {
+        for_each_column([rows](std::string_view, auto &column) { column.reserve(rows); });
+        run.reserve(rows);
+    }
+
+    void append(const telemetry_sample &sample, uint32_t run_index) {
+        time.push_back(sample.time);
+        queue_size.push_back(sample.queue_size);
+        motor_target.push_back(sample.motor_target);
+        motor_pos.push_back(sample.motor_pos);
+        motor_velocity.push_back(sample.motor_velocity);
+        motor_acceleration.push_back(sample.motor_acceleration);
+        motor_nsec_per_pulse.push_back(sample.motor_nsec_per_pulse);
+        pt202.push_back(sample.pt202);
+        pt203.push_back(sample.pt203);
+        ptf401.push_back(sample.ptf401);
+        pressure_target.push_back(sample.pressure_target);
+        run.push_back(run_index);
+    }
+
+    /// Calls fn(name, column) for each sample field's column, in the order of TELEMETRY_CSV_HEADER.
+    template<typename F>
+    void for_each_column(F &&fn) {
+        visit_columns(*this, fn);
+    }
+
+    template<typename F>
+    void for_each_column(F &&fn) const {
+        visit_columns(*this, fn);
+    }
+
+private:
+    template<typename Self, typename F>
+    static void visit_columns(Self &self, F &fn) {
+        fn("time", self.time);
+        fn("queue_size", self.queue_size);
+        fn("motor_target", self.motor_target);
+        fn("motor_pos", self.motor_pos);
+        fn("motor_velocity", self.motor_velocity);
+        fn("motor_acceleration", self.motor_acceleration);
+        fn("motor_nsec_per_pulse", self.motor_nsec_per_pulse);
+        fn("pt202", self.pt202);
+        fn("pt203", self.pt203);
+        fn("ptf401", self.ptf401);
+        fn("pressure_target", self.pressure_target);
+    }
+};
+
+/// Decodes telemetry into a TelemetryColumns. Rows are kept only inside a run, between a start and an end marker, and
+/// anything else on the connection, such as command replies, is counted and skipped.
+class TelemetryDecoder {
+public:
+    explicit TelemetryDecoder(TelemetryColumns &columns) : columns(columns) {}
+
+    /// Decodes the next chunk of a TCP stream. Chunks may split lines anywhere.
+    void feed(std::string_view bytes) {
+        if (!partial.empty()) {
+            const void *newline = std::memchr(bytes.data(), '\n', bytes.size());
+            if (newline == nullptr) {
+                partial.append(bytes);
+                return;
+            }
+            size_t len = static_cast<const char *>(newline) - bytes.data();
+            partial.append(bytes.substr(0, len));
+            line(partial);
+            partial.clear();
+            bytes.remove_prefix(len + 1);
+        }
+
+        while (const void *newline = std::memchr(bytes.data(), '\n', bytes.size())) {
+            size_t len = static_cast<const char *>(newline) - bytes.data();
+            line(bytes.substr(0, len));
+            bytes.remove_prefix(len + 1);
+        }
+        partial.assign(bytes);
+    }
+
+    /// Marks the end of the TCP stream. A trailing line without a newline was cut off mid-write, so it is dropped.
+    void finish() {
+        if (!partial.empty()) {
+            truncated_lines += 1;
+            partial.clear();
+        }
+        in_run = false;
+    }
+
+    /// Decodes one UDP datagram. Returns false if it isn't a telemetry datagram of a version this understands.
+    bool feed_datagram(std::span<const uint8_t> datagram) {
+        telemetry_datagram_header header;
+        if (datagram.size() < sizeof(header)) {
+            return false;
+        }
+        std::memcpy(&header, datagram.data(), sizeof(header));
+        if (header.magic != TELEMETRY_MAGIC || header.version != TELEMETRY_VERSION) {
+            return false;
+        }
+
+        // Unsigned subtraction, so the device's sequence number wrapping around is just another step forward.
+        uint32_t gap = header.sequence - next_sequence;
+        if (!seen_datagram || gap < UINT32_MAX / 2) {
+            if (seen_datagram) {
+                lost_datagrams += gap;
+            }
+            // Bit n of missing stands for sequence number next_sequence - 1 - n. This one was received, the gap
+            // before it wasn't.
+            missing = gap >= 63 ? 0 : missing << (gap + 1);
+            if (seen_datagram) {
+                missing |= (gap >= 63 ? ~uint64_t{0} : (uint64_t{1} << gap) - 1) << 1;
+            }
+            next_sequence = header.sequence + 1;
+            seen_datagram = true;
+        } else {
+            reordered_datagrams += 1;
+            // It was counted as lost when its gap was skipped, unless that was too long ago to tell.
+            uint32_t age = next_sequence - 1 - header.sequence;
+            if (age < 64 && (missing >> age & 1) != 0) {
+                missing &= ~(uint64_t{1} << age);
+                lost_datagrams -= 1;
+            }
+        }
+        device_send_failures = header.send_failures;
+
+        switch (header.kind) {
+            case telemetry_kind::SEQUENCE_START:
+                begin_run(telemetry_run_kind::SEQUENCE);
+                header_ok = true;
+                return true;
+            case telemetry_kind::STREAM_START:
+                begin_run(telemetry_run_kind::STREAM);
+                header_ok = true;
+                return true;
+            case telemetry_kind::SEQUENCE_END:
+            case telemetry_kind::STREAM_END:
+                end_run();
+                return true;
+            case telemetry_kind::SAMPLE: {
+                if (datagram.size() < sizeof(header) + sizeof(telemetry_sample)) {
+                    malformed_rows += 1;
+                    return true;
+                }
+                telemetry_sample sample;
+                std::memcpy(&sample, datagram.data() + sizeof(header), sizeof(sample));
+                add_row(sample);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Lines outside of a run, or that aren't telemetry.
+    uint64_t skipped_lines = 0;
+    /// Rows within a run that didn't parse, or that belong to a run with an unexpected CSV header.
+    uint64_t malformed_rows = 0;
+    /// Lines cut off by the end of the capture.
+    uint64_t truncated_lines = 0;
+    /// Datagrams missing from gaps in the device's sequence numbers that haven't turned up late.
+    uint64_t lost_datagrams = 0;
+    uint64_t reordered_datagrams = 0;
+    /// Datagrams the device failed to send, as of the last datagram received.
+    uint32_t device_send_failures = 0;
+
+private:
+    TelemetryColumns &columns;
+    /// Start of a line that the last chunk cut off.
+    std::string partial;
+    bool in_run = false;
+    /// Whether the current run's CSV header matched TELEMETRY_CSV_HEADER. Rows are only trusted if so.
+    bool header_ok = false;
+    /// Whether the line after a start marker, which should be the CSV header, is still to come.
+    bool expect_header = false;
+    bool seen_datagram = false;
+    uint32_t next_sequence = 0;
+    /// Which of the 64 sequence numbers before next_sequence were counted as lost.
+    uint64_t missing = 0;
+
+    static constexpr std::string_view strip_newline(std::string_view text) {
+        return text.substr(0, text.size() - 1);
+    }
+
+    void begin_run(telemetry_run_kind kind) {
+        // A start without an end means the device or the capture lost the end marker, so the last run is incomplete.
+        columns.runs.push_back(TelemetryRun{
+                .kind = kind,
+                .first_row = columns.size(),
+                .num_rows = 0,
+                .complete = false,
+        });
+        in_run = true;
+    }
+
+    void end_run() {
+        if (in_run) {
+            columns.runs.back().complete = true;
+        }
+        in_run = false;
+    }
+
+    void add_row(const telemetry_sample &sample) {
+        if (!in_run) {
+            skipped_lines += 1;
+            return;
+        }
+        if (!header_ok) {
+            malformed_rows += 1;
+            return;
+        }
+        columns.append(sample, static_cast<uint32_t>(columns.runs.size() - 1));
+        columns.runs.back().num_rows += 1;
+    }
+
+    void line(std::string_view text) {
+        if (!text.empty() && text.back() == '\r') {
+            text.remove_suffix(1);
+        }
+
+        if (expect_header) {
+            expect_header = false;
+            header_ok = text == strip_newline(TELEMETRY_CSV_HEADER);
+            if (header_ok) {
+                return;
+            }
+        }
+
+        // Rows are by far the most common line, and never start with a marker's '>'.
+        if (in_run && !text.empty() && text.front() != '>') {
+            telemetry_sample sample;
+            if (parse_row(text, sample)) {
+                add_row(sample);
+            } else if (text.front() == '-' || (text.front() >= '0' && text.front() <= '9')) {
+                malformed_rows += 1;
+            } else {
+                skipped_lines += 1;
+            }
+            return;
+        }
+
+        if (text == strip_newline(TELEMETRY_SEQ_START_MARKER)) {
+            begin_run(telemetry_run_kind::SEQUENCE);
+            expect_header = true;
+        } else if (text == strip_newline(TELEMETRY_STREAM_START_MARKER)) {
+            begin_run(telemetry_run_kind::STREAM);
+            expect_header = true;
+        } else if (text == strip_newline(TELEMETRY_SEQ_END_MARKER) || text == strip_newline(TELEMETRY_STREAM_END_MARKER)) {
+            end_run();
+        } else {
+            skipped_lines += 1;
+        }
+    }
+
+    /// Parses one CSV row, with the fields in struct order as telemetry_encode_csv writes them.
+    static bool parse_row(std::string_view text, telemetry_sample &sample) {
+        const char *pos = text.data();
+        const char *end = text.data() + text.size();
+        bool ok = true;
+        auto field = [&](auto &out, bool last) {
+            if (!ok) {
+                return;
+            }
+            auto [next, ec] = std::from_chars(pos, end, out);
+            ok = ec == std::errc{} && (last ? next == end : next != end && *next == ',');
+            pos = next + 1;
+        };
+
+        // The struct is packed, so fields can't be bound to references directly.
+        float time, motor_target, motor_pos, motor_velocity, motor_acceleration, pt202, pt203, ptf401, pressure_target;
+        uint32_t queue_size;
+        uint64_t motor_nsec_per_pulse;
+        field(time, false);
+        field(queue_size, false);
+        field(motor_target, false);
+        field(motor_pos, false);
+        field(motor_velocity, false);
+        field(motor_acceleration, false);
+        field(motor_nsec_per_pulse, false);
+        field(pt202, false);
+        field(pt203, false);
+        field(ptf401, false);
+        field(pressure_target, true);
+        if (!ok) {
+            return false;
+        }
+        sample = telemetry_sample{
+                .time = time,
+                .queue_size = queue_size,
+                .motor_target = motor_target,
+                .motor_pos = motor_pos,
+                .motor_velocity = motor_velocity,
+                .motor_acceleration = motor_acceleration,
+                .motor_nsec_per_pulse = motor_nsec_per_pulse,
+                .pt202 = pt202,
+                .pt203 = pt203,
+                .ptf401 = ptf401,
+                .pressure_target = pressure_target,
+        };
+        return true;
+    }
+};
+
+/// Writes the columns as CSV, in the firmware's format with a leading run column. Floats are written in their
+/// shortest form that reads back exactly.
+inline bool telemetry_write_csv(const TelemetryColumns &columns, std::ostream &out) {
+    out << "run," << TELEMETRY_CSV_HEADER;
+
+    constexpr size_t FLUSH_AT = 1 << 16;
+    constexpr size_t MAX_ROW_LEN = 512;
+    std::string buf(FLUSH_AT + MAX_ROW_LEN, '\0');
+    size_t len = 0;
+    for (size_t row = 0; row < columns.size(); ++row) {
+        char *pos = buf.data() + len;
+        char *end = buf.data() + buf.size();
+        pos = std::to_chars(pos, end, columns.run[row]).ptr;
+        columns.for_each_column([&](std::string_view, const auto &column) {
+            *pos++ = ',';
+            pos = std::to_chars(pos, end, column[row]).ptr;
+        });
+        *pos++ = '\n';
+        len = pos - buf.data();
+        if (len >= FLUSH_AT) {
+            out.write(buf.data(), static_cast<std::streamsize>(len));
+            len = 0;
+        }
+    }
+    out.write(buf.data(), static_cast<std::streamsize>(len));
+    return static_cast<bool>(out);
+}
+
+/// File extension for a column's raw binary file, naming its element type as numpy would.
+template<typename T>
+constexpr std::string_view telemetry_column_extension() {
+    if constexpr (std::is_same_v<T, float>) {
+        return ".f32";
+    } else if constexpr (std::is_same_v<T, uint32_t>) {
+        return ".u32";
+    } else {
+        static_assert(std::is_same_v<T, uint64_t>);
+        return ".u64";
+    }
+}
+
+/// Writes each column, and the run column, to its own raw little-endian file in dir, named after the column with an
+/// extension for its type, such as pt202.f32. dir is created if needed.
+inline bool telemetry_write_columns(const TelemetryColumns &columns, const std::filesystem::path &dir) {
+    std::error_code err;
+    std::filesystem::create_directories(dir, err);
+    if (err) {
+        return false;
+    }
+
+    bool ok = true;
+    auto write = [&](std::string_view name, const auto &column) {
+        using T = typename std::remove_cvref_t<decltype(column)>::value_type;
+        std::filesystem::path path = dir / (std::string(name) + std::string(telemetry_column_extension<T>()));
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char *>(column.data()), static_cast<std::streamsize>(column.size() * sizeof(T)));
+        ok = ok && static_cast<bool>(out);
+    };
+    columns.for_each_column(write);
+    write("run", columns.run);
+    return ok;
+}
+
+#endif //CLOVER_TELEMETRY_DECODER_H
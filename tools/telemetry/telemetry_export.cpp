@@ -0,0 +1,78 @@
+/*
+ * Decodes a capture of the gnc TCP telemetry stream, such as one saved with
+ *
+ *     (printf 'listen#'; cat) | nc 192.168.0.150 19690 > capture.txt
+ *
+ * and writes it out as CSV, or as one raw binary file per column:
+ *
+ *     telemetry_export capture.txt --csv capture.csv
+ *     telemetry_export capture.txt --columns capture/
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "telemetry_decoder.h"
+
+static int usage() {
+    std::fprintf(stderr, "Usage: telemetry_export <capture> (--csv <file> | --columns <dir>)\n");
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        return usage();
+    }
+    std::string_view format = argv[2];
+    if (format != "--csv" && format != "--columns") {
+        return usage();
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "Can't open %s\n", argv[1]);
+        return 1;
+    }
+
+    TelemetryColumns columns;
+    TelemetryDecoder decoder(columns);
+    std::vector<char> buf(1 << 20);
+    size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (in) {
+        in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+        auto got = static_cast<size_t>(in.gcount());
+        decoder.feed(std::string_view(buf.data(), got));
+        total += got;
+    }
+    decoder.finish();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    int complete = 0;
+    for (const TelemetryRun &run : columns.runs) {
+        complete += run.complete;
+    }
+    std::fprintf(stderr, "Decoded %zu rows in %zu runs (%d complete) from %zu bytes at %.0f MB/s\n", columns.size(),
+                 columns.runs.size(), complete, total, static_cast<double>(total) / 1e6 / elapsed.count());
+    std::fprintf(stderr, "Skipped %llu lines, %llu malformed rows, %llu truncated lines\n",
+                 static_cast<unsigned long long>(decoder.skipped_lines),
+                 static_cast<unsigned long long>(decoder.malformed_rows),
+                 static_cast<unsigned long long>(decoder.truncated_lines));
+
+    bool ok;
+    if (format == "--csv") {
+        std::ofstream out(argv[3], std::ios::binary);
+        ok = out && telemetry_write_csv(columns, out);
+    } else {
+        ok = telemetry_write_columns(columns, argv[3]);
+    }
+    if (!ok) {
+        std::fprintf(stderr, "Failed to write %s\n", argv[3]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Tests for telemetry_decoder.h. Plain asserts, so it needs nothing but a compiler.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "telemetry_decoder.h"
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+/// A capture as the firmware writes it: a command reply before the sequence, one in the middle of it, and a stream
+/// that the capture cut off mid-row.
+static std::string capture() {
+    std::string text = "Listening\n";
+    text += TELEMETRY_SEQ_START_MARKER;
+    text += TELEMETRY_CSV_HEADER;
+    text += "0.00100000,0,1.50000000,0.00000000,0.00000000,0.00000000,0,500.25000000,498.75000000,401.12500000,nan\n";
+    text += "Calibrated\n";
+    text += "0.00200000,1,3.00000000,1.50000000,1500.00000000,-12000.00000000,2777777,501.00000000,499.00000000,"
+            "402.00000000,400.00000000\r\n";
+    text += TELEMETRY_SEQ_END_MARKER;
+    text += TELEMETRY_STREAM_START_MARKER;
+    text += TELEMETRY_CSV_HEADER;
+    text += "0.00000000,0,45.00000000,45.00000000,0.00000000,0.00000000,0,10.00000000,11.00000000,12.00000000,nan\n";
+    text += "0.0010000";
+    return text;
+}
+
+static void check_capture(const TelemetryColumns &columns, const TelemetryDecoder &decoder) {
+    CHECK(columns.size() == 3);
+    CHECK(columns.runs.size() == 2);
+    CHECK(columns.runs[0].kind == telemetry_run_kind::SEQUENCE);
+    CHECK(columns.runs[0].first_row == 0 && columns.runs[0].num_rows == 2 && columns.runs[0].complete);
+    CHECK(columns.runs[1].kind == telemetry_run_kind::STREAM);
+    CHECK(columns.runs[1].first_row == 2 && columns.runs[1].num_rows == 1 && !columns.runs[1].complete);
+
+    CHECK(columns.time[1] == 0.002f);
+    CHECK(columns.queue_size[1] == 1);
+    CHECK(columns.motor_target[1] == 3.0f);
+    CHECK(columns.motor_pos[1] == 1.5f);
+    CHECK(columns.motor_velocity[1] == 1500.0f);
+    CHECK(columns.motor_acceleration[1] == -12000.0f);
+    CHECK(columns.motor_nsec_per_pulse[1] == 2777777);
+    CHECK(columns.pt202[0] == 500.25f);
+    CHECK(columns.pt203[0] == 498.75f);
+    CHECK(columns.ptf401[0] == 401.125f);
+    CHECK(std::isnan(columns.pressure_target[0]));
+    CHECK(columns.pressure_target[1] == 400.0f);
+    CHECK(columns.run[0] == 0 && columns.run[1] == 0 && columns.run[2] == 1);
+
+    CHECK(decoder.skipped_lines == 2);
+    CHECK(decoder.malformed_rows == 0);
+    CHECK(decoder.truncated_lines == 1);
+}
+
+/// The column names are the CSV header's, so exports line up with the firmware's format.
+static void test_column_names() {
+    std::string names;
+    TelemetryColumns columns;
+    columns.for_each_column([&names](std::string_view name, const auto &) {
+        names += names.empty() ? "" : ",";
+        names += name;
+    });
+    names += "\n";
+    CHECK(names == TELEMETRY_CSV_HEADER);
+}
+
+static void test_whole_capture() {
+    TelemetryColumns columns;
+    TelemetryDecoder decoder(columns);
+    decoder.feed(capture());
+    decoder.finish();
+    check_capture(columns, decoder);
+}
+
+/// Chunks may split lines, and markers, anywhere.
+static void test_every_split() {
+    std::string text = capture();
+    for (size_t split = 0; split <= text.size(); ++split) {
+        TelemetryColumns columns;
+        TelemetryDecoder decoder(columns);
+        decoder.feed(std::string_view(text).substr(0, split));
+        decoder.feed(std::string_view(text).substr(split));
+        decoder.finish();
+        check_capture(columns, decoder);
+    }
+}
+
+static void test_byte_at_a_time() {
+    std::string text = capture();
+    TelemetryColumns columns;
+    TelemetryDecoder decoder(columns);
+    for (char c : text) {
+        decoder.feed(std::string_view(&c, 1));
+    }
+    decoder.finish();
+    check_capture(columns, decoder);
+}
+
+static void test_malformed() {
+    std::string text;
+    text += TELEMETRY_SEQ_START_MARKER;
+    text += TELEMETRY_CSV_HEADER;
+    text += "0.001,0,1,2,3\n";
+    text += "0.001,0,1,2,3,4,5,6,7,8,9,10\n";
+    text += "0.001,0,1,2,3,4,5,6,7,8,x\n";
+    text += TELEMETRY_SEQ_END_MARKER;
+    // A run whose header doesn't match has rows in an unknown layout.
+    text += TELEMETRY_SEQ_START_MARKER;
+    text += "time,pt202\n";
+    text += "0.001,0,1,2,3,4,5,6,7,8,9\n";
+    text += TELEMETRY_SEQ_END_MARKER;
+
+    TelemetryColumns columns;
+    TelemetryDecoder decoder(columns);
+    decoder.feed(text);
+    decoder.finish();
+    CHECK(columns.size() == 0);
+    CHECK(columns.runs.size() == 2);
+    CHECK(decoder.malformed_rows == 4);
+}
+
+static std::vector<uint8_t> datagram(telemetry_kind kind, uint32_t sequence, const telemetry_sample *sample) {
+    telemetry_datagram_header header{};
+    header.magic = TELEMETRY_MAGIC;
+    header.version = TELEMETRY_VERSION;
+    header.kind = kind;
+    header.sequence = sequence;
+    header.send_failures = 7;
+    std::vector<uint8_t> bytes(sizeof(header) + (sample ? sizeof(*sample) : 0));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    if (sample) {
+        std::memcpy(bytes.data() + sizeof(header), sample, sizeof(*sample));
+    }
+    return bytes;
+}
+
+static void test_datagrams() {
+    telemetry_sample sample{};
+    sample.pt202 = 123.5f;
+    sample.motor_nsec_per_pulse = 42;
+
+    TelemetryColumns columns;
+    TelemetryDecoder decoder(columns);
+    CHECK(decoder.feed_datagram(datagram(telemetry_kind::SEQUENCE_START, 10, nullptr)));
+    CHECK(decoder.feed_datagram(datagram(telemetry_kind::SAMPLE, 11, &sample)));
+    // 12 and 13 lost, then 12 arrives late.
+    CHECK(decoder.feed_datagram(datagram(telemetry_kind::SAMPLE, 14, &sample)));
+    CHECK(decoder.feed_datagram(datagram(telemetry_kind::SAMPLE, 12, &sample)));
+    CHECK(decoder.feed_datagram(datagram(telemetry_kind::SEQUENCE_END, 15, nullptr)));
+    // A repeat of a datagram that wasn't lost.
+    CHECK(decoder.feed_datagram(datagram(telemetry_kind::SEQUENCE_END, 15, nullptr)));
+
+    std::vector<uint8_t> bad = datagram(telemetry_kind::SAMPLE, 16, &sample);
+    bad[0] ^= 1;
+    CHECK(!decoder.feed_datagram(bad));
+    CHECK(!decoder.feed_datagram(std::span<const uint8_t>(bad).first(4)));
+
+    CHECK(columns.size() == 3);
+    CHECK(columns.runs.size() == 1 && columns.runs[0].complete);
+    CHECK(columns.pt202[2] == 123.5f);
+    CHECK(columns.motor_nsec_per_pulse[2] == 42);
+    CHECK(decoder.lost_datagrams == 1);
+    CHECK(decoder.reordered_datagrams == 2);
+    CHECK(decoder.device_send_failures == 7);
+}
+
+static void test_exports() {
+    TelemetryColumns columns;
+    TelemetryDecoder decoder(columns);
+    decoder.feed(capture());
+    decoder.finish();
+
+    std::ostringstream csv;
+    CHECK(telemetry_write_csv(columns, csv));
+    std::string text = csv.str();
+    CHECK(text.starts_with(std::string("run,") + std::string(TELEMETRY_CSV_HEADER)));
+    CHECK(text.find("\n0,0.002,1,3,1.5,1500,-12000,2777777,501,499,402,400\n") != std::string::npos);
+    CHECK(text.ends_with("\n1,0,0,45,45,0,0,0,10,11,12,nan\n"));
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "telemetry_decoder_test";
+    std::filesystem::remove_all(dir);
+    CHECK(telemetry_write_columns(columns, dir));
+    CHECK(std::filesystem::file_size(dir / "pt202.f32") == 3 * sizeof(float));
+    CHECK(std::filesystem::file_size(dir / "motor_nsec_per_pulse.u64") == 3 * sizeof(uint64_t));
+    CHECK(std::filesystem::file_size(dir / "run.u32") == 3 * sizeof(uint32_t));
+    std::ifstream in(dir / "ptf401.f32", std::ios::binary);
+    float ptf401[3];
+    in.read(reinterpret_cast<char *>(ptf401), sizeof(ptf401));
+    CHECK(ptf401[0] == 401.125f && ptf401[2] == 12.0f);
+    std::filesystem::remove_all(dir);
+}
+
+int main() {
+    test_column_names();
+    test_whole_capture();
+    test_every_split();
+    test_byte_at_a_time();
+    test_malformed();
+    test_datagrams();
+    test_exports();
+    std::printf("All telemetry decoder tests passed\n");
+    return 0;
+}